@@ -0,0 +1,70 @@
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "future.h"
+
+/*
+ * one interface over the CUDA and the OpenCL samples, so that the same operation can be run
+ * and timed on either API, and a program still runs where one of them is missing. a backend
+ * owns its device, one in-order queue (a CUDA stream) and the compiled kernels; everything is
+ * enqueued on that queue, so an operation returns before the device is done with it.
+ * every call returns the Status of enqueueing it. an error the device only hits later, like
+ * a kernel fault, shows in the Status of the next finish() or submit(), which also repeat the
+ * first enqueue error since the last of them, so a caller can check once per batch.
+ * implementations: cuda_backend.h, opencl_backend.h; compare.cu runs each operation on both.
+ */
+
+// device memory of one backend; only that backend can use it
+class BackendBuffer {
+public:
+  virtual ~BackendBuffer() {}
+  virtual size_t bytes() const = 0;
+};
+
+// pinned host memory of one backend, which its asynchronous copies overlap the caller from
+class HostBuffer {
+public:
+  virtual ~HostBuffer() {}
+  virtual void* data() = 0;
+  virtual size_t bytes() const = 0;
+};
+
+class Backend {
+public:
+  virtual ~Backend() {}
+
+  virtual const char* name() const = 0;                 // "cuda" or "opencl"
+  virtual std::string deviceName() const = 0;           // The device it picked.
+
+  virtual std::unique_ptr<BackendBuffer> allocate(size_t bytes) = 0;          // nullptr when the device is out of memory.
+  virtual std::unique_ptr<HostBuffer> allocateHost(size_t bytes) = 0;         // nullptr when it cannot be pinned.
+  virtual Status write(BackendBuffer& dst, const void* src, size_t bytes) = 0; // Blocks until src may be reused.
+  virtual Status read(void* dst, const BackendBuffer& src, size_t bytes) = 0;  // Blocks until dst holds the data.
+
+  // the non-blocking copies: src and dst must stay valid, and src unchanged, until the
+  // future completes. from pinned host memory they overlap the caller, otherwise the driver
+  // may stage them before returning
+  virtual BackendFuture writeAsync(BackendBuffer& dst, const void* src, size_t bytes) = 0;
+  virtual BackendFuture readAsync(void* dst, const BackendBuffer& src, size_t bytes) = 0;
+
+  virtual Status add(const BackendBuffer& a, const BackendBuffer& b, BackendBuffer& c, int n) = 0;  // c = a + b, of ints.
+  virtual Status square(const BackendBuffer& in, BackendBuffer& out, int n) = 0;                    // out = in * in, of floats.
+  virtual Status reduceSum(const BackendBuffer& in, BackendBuffer& out, int n) = 0;                 // out[0] = sum of n floats.
+
+  // out[s] = sum of the floats from in[offsets[s]] up to offsets[s + 1], for every one of the
+  // segments; offsets holds segments + 1 ascending ints. one launch for a batch of short sums
+  virtual Status segmentedReduceSum(const BackendBuffer& in, const BackendBuffer& offsets, BackendBuffer& out,
+                                    int segments) = 0;
+
+  virtual BackendFuture submit() = 0;                   // Completes when everything enqueued so far has.
+  virtual Status finish() = 0;                          // Wait until everything enqueued has completed.
+
+  // device time from startTimer() to the end of everything enqueued before stopTimer(), in ms
+  virtual void startTimer() = 0;
+  virtual double stopTimer() = 0;
+};
+
+#endif  /* __BACKEND_H__ */
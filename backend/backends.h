@@ -0,0 +1,42 @@
+#ifndef __BACKENDS_H__
+#define __BACKENDS_H__
+
+#include <memory>
+#include <vector>
+#include "backend.h"
+#ifdef __CUDACC__
+#include "cuda_backend.h"
+#endif
+#ifndef NO_OPENCL
+#include "opencl_backend.h"
+#endif
+
+// the backends a program was built with: compiled with nvcc it has both, -DNO_OPENCL leaves
+// OpenCL out, and compiled as C++ without nvcc it has OpenCL only (see the README)
+
+#ifdef EMBED_KERNELS
+#include "kernels_cl.h"   // generated at build time with: xxd -i kernels.cl > kernels_cl.h
+static const unsigned char* kernelsSource = kernels_cl;
+static const size_t kernelsSourceLength = kernels_cl_len;
+#else
+static const unsigned char* kernelsSource = nullptr;
+static const size_t kernelsSourceLength = 0;
+#endif
+
+// every backend this binary has that finds a device, CUDA first
+inline std::vector<std::unique_ptr<Backend>> availableBackends() {
+  std::vector<std::unique_ptr<Backend>> backends;
+#ifdef __CUDACC__
+  if(auto cuda = CudaBackend::create()) {
+    backends.push_back(std::move(cuda));
+  }
+#endif
+#ifndef NO_OPENCL
+  if(auto opencl = OpenCLBackend::create(Devices::kernelSource("kernels.cl", kernelsSource, kernelsSourceLength))) {
+    backends.push_back(std::move(opencl));
+  }
+#endif
+  return backends;
+}
+
+#endif  /* __BACKENDS_H__ */
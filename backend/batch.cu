@@ -0,0 +1,178 @@
+// many small add, square and sum requests of random sizes on the first backend that finds a
+// device: once with a launch and a round trip per request, once through the Batcher from a
+// few submitting threads. the throughput is in requests per second (see backends.h for
+// which backends a build has)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../common/benchmark.h"
+#include "backends.h"
+#include "batcher.h"
+
+
+// one request, with its input a window into the shared input arrays
+struct Request {
+  Batcher::Operation op;
+  int offset, n;
+  std::vector<int> c;       // Result of an add.
+  std::vector<float> y;     // Result of a square.
+  float sum;                // Result of a sum.
+};
+
+// the result of every request against the host; the sums only agree up to rounding
+bool checkRequests(const std::vector<Request>& requests, const std::vector<int>& a, const std::vector<int>& b,
+                   const std::vector<float>& x) {
+  for(auto& r : requests) {
+    double total = 0;
+    for(int i = 0; i < r.n; i++) {
+      int k = r.offset + i;
+      if((r.op == Batcher::ADD && r.c[i] != a[k] + b[k]) || (r.op == Batcher::SQUARE && r.y[i] != x[k] * x[k])) {
+        return false;
+      }
+      total += x[k];
+    }
+    if(r.op == Batcher::REDUCE_SUM && std::fabs(r.sum - total) > 1e-3 * std::max(1.0, std::fabs(total))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+int main(int argc, char** argv) {
+  // "batch [requests] [largest request] [deadline in us]"
+  int REQUESTS = argc >= 2 ? atoi(argv[1]) : 5000;
+  int MAX_SIZE = argc >= 3 ? atoi(argv[2]) : 4096;
+  int DEADLINE = argc >= 4 ? atoi(argv[3]) : 200;
+  const int THREADS = 4;
+  if(REQUESTS <= 0 || MAX_SIZE <= 0 || DEADLINE < 0) {
+    fprintf(stderr, "error: the counts must be positive\n");
+    return 1;
+  }
+
+  auto backends = availableBackends();
+  if(backends.empty()) {
+    fprintf(stderr, "error: no backend found a device\n");
+    return 1;
+  }
+  Backend& backend = *backends.front();
+  printf("%s: %s, %d requests of up to %d elements\n", backend.name(), backend.deviceName().c_str(), REQUESTS, MAX_SIZE);
+
+  // the inputs every request takes its window from
+  const int INPUT_SIZE = 4 * MAX_SIZE;
+  std::vector<int> a(INPUT_SIZE), b(INPUT_SIZE);
+  std::vector<float> x(INPUT_SIZE);
+  for(int i = 0; i < INPUT_SIZE; i++) {
+    a[i] = (int) (random() % 201) - 100;
+    b[i] = (int) (random() % 201) - 100;
+    x[i] = -1.0f + (float) random() / ((float) RAND_MAX / 2.0f);
+  }
+
+  std::vector<Request> requests(REQUESTS);
+  for(auto& r : requests) {
+    r.op = (Batcher::Operation) (random() % Batcher::OPERATIONS);
+    r.n = 1 + (int) (random() % MAX_SIZE);
+    r.offset = (int) (random() % (INPUT_SIZE - r.n + 1));
+    r.c.resize(r.op == Batcher::ADD ? r.n : 0);
+    r.y.resize(r.op == Batcher::SQUARE ? r.n : 0);
+    r.sum = 0;
+  }
+
+  // one launch per request, waiting for its result before the next
+  auto dA = backend.allocate(MAX_SIZE * sizeof(int)), dB = backend.allocate(MAX_SIZE * sizeof(int));
+  auto dC = backend.allocate(MAX_SIZE * sizeof(int)), dX = backend.allocate(MAX_SIZE * sizeof(float));
+  auto dY = backend.allocate(MAX_SIZE * sizeof(float)), dSum = backend.allocate(sizeof(float));
+  if(!dA || !dB || !dC || !dX || !dY || !dSum) {
+    fprintf(stderr, "error: %s cannot allocate %d elements\n", backend.name(), MAX_SIZE);
+    return 1;
+  }
+
+  Status failed = Status::success();
+  double unbatched = Benchmark("batch", std::string("unbatched/") + backend.name()).elements(REQUESTS).warmup(1).repetitions(3)
+    .run([&] {
+      return wallTime([&] {
+        for(auto& r : requests) {
+          Status status = Status::success();
+          if(r.op == Batcher::ADD) {
+            backend.write(*dA, &a[r.offset], r.n * sizeof(int));
+            backend.write(*dB, &b[r.offset], r.n * sizeof(int));
+            backend.add(*dA, *dB, *dC, r.n);
+            status = backend.read(r.c.data(), *dC, r.n * sizeof(int));
+          } else if(r.op == Batcher::SQUARE) {
+            backend.write(*dX, &x[r.offset], r.n * sizeof(float));
+            backend.square(*dX, *dY, r.n);
+            status = backend.read(r.y.data(), *dY, r.n * sizeof(float));
+          } else {
+            backend.write(*dX, &x[r.offset], r.n * sizeof(float));
+            backend.reduceSum(*dX, *dSum, r.n);
+            status = backend.read(&r.sum, *dSum, sizeof(float));
+          }
+          if(!status.ok() && failed.ok()) {
+            failed = status;
+          }
+        }
+      });
+    }).median;
+  bool unbatchedCorrect = failed.ok() && checkRequests(requests, a, b, x);
+
+  for(auto& r : requests) {
+    std::fill(r.c.begin(), r.c.end(), 0);
+    std::fill(r.y.begin(), r.y.end(), 0.0f);
+    r.sum = 0;
+  }
+
+  // the same requests through the batcher, every thread submitting its share without waiting
+  size_t batchesBefore = 0, batchesAfter = 0;
+  double batched;
+  std::atomic<bool> batchFailed(false);
+  {
+    Batcher batcher(backend, 1 << 20, std::chrono::microseconds(DEADLINE));
+    batched = Benchmark("batch", std::string("batched/") + backend.name()).elements(REQUESTS).warmup(1).repetitions(3)
+      .run([&] {
+        batchesBefore = batcher.batches();
+        double ms = wallTime([&] {
+          std::vector<std::thread> submitters;
+          for(int t = 0; t < THREADS; t++) {
+            submitters.emplace_back([&, t] {
+              std::vector<BackendFuture> futures;
+              for(int i = t; i < REQUESTS; i += THREADS) {
+                Request& r = requests[i];
+                if(r.op == Batcher::ADD) {
+                  futures.push_back(batcher.add(&a[r.offset], &b[r.offset], r.c.data(), r.n));
+                } else if(r.op == Batcher::SQUARE) {
+                  futures.push_back(batcher.square(&x[r.offset], r.y.data(), r.n));
+                } else {
+                  futures.push_back(batcher.reduceSum(&x[r.offset], &r.sum, r.n));
+                }
+              }
+              Status status = BackendFuture::all(futures).wait();
+              if(!status.ok()) {
+                fprintf(stderr, "error: %s\n", status.message.c_str());
+                batchFailed = true;
+              }
+            });
+          }
+          for(auto& submitter : submitters) {
+            submitter.join();
+          }
+        });
+        batchesAfter = batcher.batches();
+        return ms;
+      }).median;
+  }
+  bool batchedCorrect = !batchFailed && checkRequests(requests, a, b, x);
+
+  printf("unbatched: %s, %f ms for %d requests\n", unbatchedCorrect ? "SUCCESS!" : "FAILED!", unbatched, REQUESTS);
+  printf("batched: %s, %f ms in %d launches (%.1f requests each), %.2fx the throughput\n",
+         batchedCorrect ? "SUCCESS!" : "FAILED!", batched, (int) (batchesAfter - batchesBefore),
+         (double) REQUESTS / std::max<size_t>(batchesAfter - batchesBefore, 1), unbatched / batched);
+
+  return unbatchedCorrect && batchedCorrect ? 0 : 1;
+}
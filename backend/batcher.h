@@ -0,0 +1,329 @@
+#ifndef __BATCHER_H__
+#define __BATCHER_H__
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "backend.h"
+
+/*
+ * packs many small requests into one launch per operation, for callers whose requests are
+ * each far too small to fill a device. a request is copied into the pending batch of its
+ * operation right away, so its input can be reused as soon as the call returns; its output is
+ * written, and its future completed, once the batch it went into is back on the host.
+ * a batch is launched when it holds maxElements elements, when its oldest request has waited
+ * for "deadline", or on flush(). the elementwise operations run on the batch as one array, the
+ * sums as one segmented reduction with a segment per request.
+ * any thread may submit; the batcher must be the only user of its backend while it lives, and
+ * a future's callbacks must not submit to it (they run on the driver's thread, see future.h).
+ * a batch is packed straight into pinned host memory (Backend::allocateHost()), so its
+ * copies never block the launch. every operation has STAGING_SETS of it, so the next batch is
+ * packed while the last is in flight; a submitter only waits when all of them are
+ */
+
+class Batcher {
+public:
+  enum Operation { ADD, SQUARE, REDUCE_SUM, OPERATIONS };
+
+  Batcher(Backend& backend, size_t maxElements = 1 << 20,
+          std::chrono::microseconds deadline = std::chrono::microseconds(500))
+    : backend(backend), maxElements(std::max<size_t>(maxElements, 1)), deadline(deadline), stopping(false),
+      inFlight(0), launched(0), submitted(0), flusher(&Batcher::flushOnDeadline, this) {
+    std::lock_guard<std::mutex> lock(doneMutex);
+    for(int op = 0; op < OPERATIONS; op++) {
+      for(int i = 0; i < STAGING_SETS; i++) {
+        idleStaging[op].push_back(&staging[op][i]);
+      }
+    }
+  }
+
+  // launches what is still pending and waits until every batch is back
+  ~Batcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      for(int op = 0; op < OPERATIONS; op++) {
+        launch((Operation) op);
+      }
+    }
+    wakeup.notify_one();
+    flusher.join();
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    idle.wait(lock, [this] { return inFlight == 0; });
+  }
+
+  BackendFuture add(const int* a, const int* b, int* c, int n) { return submit(ADD, a, b, c, n); }   // c = a + b
+  BackendFuture square(const float* in, float* out, int n) { return submit(SQUARE, in, nullptr, out, n); }
+  BackendFuture reduceSum(const float* in, float* out, int n) { return submit(REDUCE_SUM, in, nullptr, out, n); }
+
+  // launches every pending batch now
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int op = 0; op < OPERATIONS; op++) {
+      launch((Operation) op);
+    }
+  }
+
+  size_t batches() const {            // Batches launched so far.
+    std::lock_guard<std::mutex> lock(mutex);
+    return launched;
+  }
+
+  size_t requests() const {           // Requests submitted so far.
+    std::lock_guard<std::mutex> lock(mutex);
+    return submitted;
+  }
+
+private:
+  static const size_t ELEMENT_BYTES = 4;    // Every operation works on ints or floats.
+  static const int STAGING_SETS = 2;        // Batches of one operation packed or in flight at once.
+
+  // where the result of one request goes
+  struct Request {
+    void* out;
+    int count;                        // Elements of the result: the input's, or 1 for a sum.
+    BackendFuture future;
+  };
+
+  // the device side of a batch
+  struct Buffers {
+    std::unique_ptr<BackendBuffer> inputs[2], offsets, output;
+  };
+
+  // the pinned host memory one batch is packed into and read back to, and the device buffers
+  // it runs in; all grown as the batches need, never while a batch holds them
+  struct Staging {
+    std::unique_ptr<HostBuffer> inputs[2], offsets, output;
+    Buffers device;
+  };
+
+  // the requests of one operation packed back to back into "staging", with the result once it
+  // is back; the offsets say where every request starts, and at launch where the last ends
+  struct Batch {
+    Staging* staging = nullptr;       // Taken at the first request and given back once scattered.
+    std::vector<Request> requests;
+    size_t elements = 0;
+    std::chrono::steady_clock::time_point oldest;
+  };
+
+  static int inputCount(Operation op) { return op == ADD ? 2 : 1; }
+
+  BackendFuture submit(Operation op, const void* first, const void* second, void* out, int n) {
+    if(n <= 0 && op != REDUCE_SUM) {
+      return BackendFuture::completed(Status::success());
+    }
+    n = std::max(n, 0);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Batch* batch = &pending[op];
+    if(batch->elements > 0 && batch->elements + n > maxElements) {
+      launch(op);
+    }
+    if(!batch->staging) {
+      batch->staging = takeStaging(op);
+    }
+
+    // room for this request, and the end offset the launch adds
+    Staging& staging = *batch->staging;
+    size_t elements = batch->elements + n, segments = batch->requests.size() + 1;
+    bool reserved = reserveHost(staging.offsets, (segments + 1) * sizeof(int), (segments - 1) * sizeof(int));
+    for(int i = 0; i < inputCount(op); i++) {
+      reserved = reserved && reserveHost(staging.inputs[i], elements * ELEMENT_BYTES, batch->elements * ELEMENT_BYTES);
+    }
+    if(!reserved) {
+      return BackendFuture::completed(Status{ -1, "batcher: cannot pin host memory for the batch" });
+    }
+
+    if(batch->requests.empty()) {
+      batch->oldest = std::chrono::steady_clock::now();
+      wakeup.notify_one();
+    }
+    const void* inputs[2] = { first, second };
+    for(int i = 0; i < inputCount(op); i++) {
+      std::memcpy(static_cast<unsigned char*>(staging.inputs[i]->data()) + batch->elements * ELEMENT_BYTES, inputs[i],
+                  n * ELEMENT_BYTES);
+    }
+    static_cast<int*>(staging.offsets->data())[segments - 1] = (int) batch->elements;
+    batch->requests.push_back(Request{ out, op == REDUCE_SUM ? 1 : n, BackendFuture() });
+    batch->elements = elements;
+    submitted++;
+
+    BackendFuture future = batch->requests.back().future;
+    if(batch->elements >= maxElements) {
+      launch(op);
+    }
+    return future;
+  }
+
+  // a staging set of "op" that no batch holds, waiting for one to be scattered if none is.
+  // waits with "mutex" held, so the other submitters of the operation wait in line behind
+  Staging* takeStaging(Operation op) {
+    std::unique_lock<std::mutex> lock(doneMutex);
+    idle.wait(lock, [this, op] { return !idleStaging[op].empty(); });
+    Staging* set = idleStaging[op].back();
+    idleStaging[op].pop_back();
+    return set;
+  }
+
+  // with the mutex held: writes the pending batch of "op", runs it with one launch and reads
+  // it back, all without waiting; the last of them completing scatters the results
+  void launch(Operation op) {
+    if(pending[op].requests.empty()) {
+      return;
+    }
+    auto batch = std::make_shared<Batch>(std::move(pending[op]));
+    pending[op] = Batch();
+
+    {
+      std::lock_guard<std::mutex> lock(doneMutex);
+      inFlight++;
+    }
+    Staging& staging = *batch->staging;
+    int n = (int) batch->elements, segments = (int) batch->requests.size();
+    int* offsets = static_cast<int*>(staging.offsets->data());
+    offsets[segments] = n;
+    size_t outBytes = (op == REDUCE_SUM ? segments : n) * ELEMENT_BYTES;
+
+    Buffers& buffers = staging.device;
+    bool reserved = reserveHost(staging.output, outBytes, 0) && reserve(buffers.output, outBytes) &&
+                    (op != REDUCE_SUM || reserve(buffers.offsets, (segments + 1) * sizeof(int)));
+    for(int i = 0; i < inputCount(op); i++) {
+      reserved = reserved && reserve(buffers.inputs[i], n * ELEMENT_BYTES);
+    }
+    if(!reserved) {
+      done(op, *batch, Status{ -1, "batcher: the device is out of memory" });
+      return;
+    }
+
+    std::vector<BackendFuture> steps;
+    for(int i = 0; i < inputCount(op); i++) {
+      steps.push_back(backend.writeAsync(*buffers.inputs[i], staging.inputs[i]->data(), n * ELEMENT_BYTES));
+    }
+
+    // a failed launch shows in the status of the read after it
+    switch(op) {
+    case ADD:
+      backend.add(*buffers.inputs[0], *buffers.inputs[1], *buffers.output, n);
+      break;
+    case SQUARE:
+      backend.square(*buffers.inputs[0], *buffers.output, n);
+      break;
+    default:
+      steps.push_back(backend.writeAsync(*buffers.offsets, offsets, (segments + 1) * sizeof(int)));
+      backend.segmentedReduceSum(*buffers.inputs[0], *buffers.offsets, *buffers.output, segments);
+      break;
+    }
+    steps.push_back(backend.readAsync(staging.output->data(), *buffers.output, outBytes));
+    launched++;
+
+    BackendFuture::all(steps).then([this, op, batch](const Status& status) {
+      done(op, *batch, status);
+    });
+  }
+
+  // scatters a launched batch and gives its staging set back; notified under the lock, so the
+  // destructor cannot finish in between
+  void done(Operation op, const Batch& batch, const Status& status) {
+    scatter(op, batch, status);
+    std::lock_guard<std::mutex> lock(doneMutex);
+    idleStaging[op].push_back(batch.staging);
+    inFlight--;
+    idle.notify_all();
+  }
+
+  bool reserve(std::unique_ptr<BackendBuffer>& buffer, size_t bytes) {
+    if(!buffer || buffer->bytes() < bytes) {
+      buffer = backend.allocate(bytes);
+    }
+    return buffer != nullptr;
+  }
+
+  // grows pinned host memory to "bytes", keeping the first "keep" bytes it holds; false when it
+  // cannot, with the old memory left as it was
+  bool reserveHost(std::unique_ptr<HostBuffer>& buffer, size_t bytes, size_t keep) {
+    if(buffer && buffer->bytes() >= bytes) {
+      return true;
+    }
+    // doubled, so packing request after request grows it only a few times
+    std::unique_ptr<HostBuffer> grown = backend.allocateHost(std::max(bytes, buffer ? 2 * buffer->bytes() : bytes));
+    if(!grown) {
+      return false;
+    }
+    if(buffer && keep > 0) {
+      std::memcpy(grown->data(), buffer->data(), keep);
+    }
+    buffer = std::move(grown);
+    return true;
+  }
+
+  // copies every request's share of the result to it, unless the batch failed, and completes it
+  static void scatter(Operation op, const Batch& batch, const Status& status) {
+    const unsigned char* output = status.ok() ? static_cast<const unsigned char*>(batch.staging->output->data()) : nullptr;
+    const int* offsets = static_cast<const int*>(batch.staging->offsets->data());
+    for(size_t r = 0; r < batch.requests.size(); r++) {
+      const Request& request = batch.requests[r];
+      if(output) {
+        size_t offset = op == REDUCE_SUM ? r : offsets[r];
+        std::memcpy(request.out, output + offset * ELEMENT_BYTES, request.count * ELEMENT_BYTES);
+      }
+      request.future.complete(status);
+    }
+  }
+
+  // launches a batch once its oldest request has waited for the deadline
+  void flushOnDeadline() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopping) {
+      bool waiting = false;
+      std::chrono::steady_clock::time_point next;
+      for(auto& batch : pending) {
+        if(!batch.requests.empty() && (!waiting || batch.oldest + deadline < next)) {
+          next = batch.oldest + deadline;
+          waiting = true;
+        }
+      }
+
+      if(waiting) {
+        wakeup.wait_until(lock, next);
+      } else {
+        wakeup.wait(lock);
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      for(int op = 0; op < OPERATIONS; op++) {
+        if(!pending[op].requests.empty() && pending[op].oldest + deadline <= now) {
+          launch((Operation) op);
+        }
+      }
+    }
+  }
+
+  Backend& backend;
+  const size_t maxElements;
+  const std::chrono::microseconds deadline;
+
+  mutable std::mutex mutex;           // Guards the pending batches and the backend.
+  std::condition_variable wakeup;     // A batch got its first request, or the batcher is stopping.
+  bool stopping;
+  Batch pending[OPERATIONS];
+
+  // a separate lock, because the completions come from the driver's thread, which may have to
+  // run while a submitter holds "mutex" inside a backend call
+  std::mutex doneMutex;
+  std::condition_variable idle;       // A batch was scattered.
+  int inFlight;                       // Batches launched but not yet scattered.
+  Staging staging[OPERATIONS][STAGING_SETS];
+  std::vector<Staging*> idleStaging[OPERATIONS];    // The sets no batch holds.
+
+  size_t launched, submitted;
+  std::thread flusher;                // Runs flushOnDeadline(); started last, once the rest is set.
+};
+
+#endif  /* __BATCHER_H__ */
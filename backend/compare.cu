@@ -0,0 +1,119 @@
+// runs the same operations on every backend that was built in and finds a device, checks
+// them against the host, and picks the faster backend for each operation on this machine
+// (see backends.h for which backends a build has)
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../common/benchmark.h"
+#include "backends.h"
+
+
+// the median device time of run() on the backend, through the harness as "operation/backend"
+template <typename F>
+double deviceTime(Backend& backend, const std::string& operation, double bytes, int n, F run) {
+  return Benchmark("backend", operation + "/" + backend.name()).bytes(bytes).elements(n).run([&] {
+    backend.startTimer();
+    run();
+    return backend.stopTimer();
+  }).median;
+}
+
+
+int main(int argc, char** argv) {
+  int N = 1 << 24;
+  if(argc >= 2) {
+    N = atoi(argv[1]);
+  }
+  if(N <= 0) {
+    fprintf(stderr, "error: the size must be positive\n");
+    return 1;
+  }
+
+  auto backends = availableBackends();
+  if(backends.empty()) {
+    fprintf(stderr, "error: no backend found a device\n");
+    return 1;
+  }
+  for(auto& backend : backends) {
+    printf("%s: %s\n", backend->name(), backend->deviceName().c_str());
+  }
+
+  // the inputs, and what every backend has to get out of them
+  std::vector<int> a(N), b(N), sum(N);
+  std::vector<float> x(N), squares(N);
+  double total = 0;
+  for(int i = 0; i < N; i++) {
+    a[i] = (int) (random() % 201) - 100;
+    b[i] = (int) (random() % 201) - 100;
+    sum[i] = a[i] + b[i];
+    x[i] = -1.0f + (float) random() / ((float) RAND_MAX / 2.0f);
+    squares[i] = x[i] * x[i];
+    total += x[i];
+  }
+
+  const char* operations[] = { "add", "square", "reduce_sum" };
+  std::vector<std::vector<double>> times(3);
+
+  for(auto& backend : backends) {
+    auto dA = backend->allocate(N * sizeof(int)), dB = backend->allocate(N * sizeof(int));
+    auto dC = backend->allocate(N * sizeof(int));
+    auto dX = backend->allocate(N * sizeof(float)), dY = backend->allocate(N * sizeof(float));
+    auto dSum = backend->allocate(sizeof(float));
+    if(!dA || !dB || !dC || !dX || !dY || !dSum) {
+      fprintf(stderr, "error: %s cannot allocate %d elements\n", backend->name(), N);
+      return 1;
+    }
+
+    // the queue is in order, so the last write completing means all three did
+    backend->writeAsync(*dA, a.data(), N * sizeof(int));
+    backend->writeAsync(*dB, b.data(), N * sizeof(int));
+    Status status = backend->writeAsync(*dX, x.data(), N * sizeof(float)).wait();
+    if(!status.ok()) {
+      fprintf(stderr, "error: %s: %s\n", backend->name(), status.message.c_str());
+      return 1;
+    }
+
+    times[0].push_back(deviceTime(*backend, "add", 3.0 * N * sizeof(int), N, [&] { backend->add(*dA, *dB, *dC, N); }));
+    times[1].push_back(deviceTime(*backend, "square", 2.0 * N * sizeof(float), N, [&] { backend->square(*dX, *dY, N); }));
+    times[2].push_back(deviceTime(*backend, "reduce_sum", (double) N * sizeof(float), N,
+                                  [&] { backend->reduceSum(*dX, *dSum, N); }));
+
+    // an error in any of the timed runs shows in the status of the reads
+    std::vector<int> c(N);
+    std::vector<float> y(N);
+    float s = 0;
+    backend->readAsync(c.data(), *dC, N * sizeof(int));
+    backend->readAsync(y.data(), *dY, N * sizeof(float));
+    status = backend->readAsync(&s, *dSum, sizeof(float)).wait();
+    if(!status.ok()) {
+      printf("%s: FAILED! (%s)\n", backend->name(), status.message.c_str());
+      continue;
+    }
+
+    // the sum is added in a different order than on the host, so it only agrees up to rounding
+    bool correct = c == sum && y == squares && std::fabs(s - total) <= 1e-3 * std::max(1.0, std::fabs(total)) + 1e-2;
+    printf("%s: %s (sum %f, host %f)\n", backend->name(), correct ? "SUCCESS!" : "FAILED!", s, total);
+  }
+
+  // the faster backend of each operation on this machine
+  for(int op = 0; op < 3; op++) {
+    size_t best = 0;
+    for(size_t i = 1; i < backends.size(); i++) {
+      if(times[op][i] < times[op][best]) {
+        best = i;
+      }
+    }
+    printf("%s: %s is fastest, %f ms", operations[op], backends[best]->name(), times[op][best]);
+    for(size_t i = 0; i < backends.size(); i++) {
+      if(i != best) {
+        printf(", %.2fx faster than %s", times[op][i] / times[op][best], backends[i]->name());
+      }
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,249 @@
+#ifndef __CUDA_BACKEND_H__
+#define __CUDA_BACKEND_H__
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <cuda_runtime.h>
+#include "backend.h"
+#include "../cuda/device_pool.h"
+#include "../cuda/elementwise.h"
+#include "../cuda/reduce.h"
+
+// c = a + b one int4 per step of a grid-stride loop, the CUDA twin of opencl/vector_add/add.cl
+__global__ void backend_add_kernel(const int* a, const int* b, int* c, int n) {
+  int vecs = n / 4;
+  for(int i = threadIdx.x + blockDim.x * blockIdx.x; i < vecs; i += blockDim.x * gridDim.x) {
+    int4 x = reinterpret_cast<const int4*>(a)[i], y = reinterpret_cast<const int4*>(b)[i];
+    reinterpret_cast<int4*>(c)[i] = make_int4(x.x + y.x, x.y + y.y, x.z + y.z, x.w + y.w);
+  }
+
+  int tail = vecs * 4 + threadIdx.x + blockDim.x * blockIdx.x;
+  if(tail < n) {
+    c[tail] = a[tail] + b[tail];
+  }
+}
+
+
+// pool memory; it goes back to the pool tagged on the legacy default stream, which waits for
+// the backend's blocking stream
+class CudaBuffer : public BackendBuffer {
+public:
+  explicit CudaBuffer(size_t bytes) : data(bytes) {}
+  size_t bytes() const { return data.bytes(); }
+
+  DeviceBuffer<unsigned char> data;
+};
+
+
+// page-locked memory from cudaHostAlloc, so the copies from and to it are truly asynchronous
+class CudaHostBuffer : public HostBuffer {
+public:
+  explicit CudaHostBuffer(size_t bytes) : ptr(nullptr), size(bytes) {
+    if(cudaHostAlloc(&ptr, std::max<size_t>(bytes, 1), cudaHostAllocDefault) != cudaSuccess) {
+      cudaGetLastError();
+      ptr = nullptr;
+    }
+  }
+
+  ~CudaHostBuffer() {
+    if(ptr) {
+      cudaFreeHost(ptr);
+    }
+  }
+
+  void* data() { return ptr; }
+  size_t bytes() const { return size; }
+
+private:
+  void* ptr;
+  size_t size;
+};
+
+
+// the kernels of cuda/, on the device $CUDA_DEVICE (an index, 0 by default)
+class CudaBackend : public Backend {
+public:
+  // nullptr when there is no CUDA device
+  static std::unique_ptr<Backend> create() {
+    int count = 0;
+    if(cudaGetDeviceCount(&count) != cudaSuccess || count == 0) {
+      cudaGetLastError();
+      return nullptr;
+    }
+    const char* choice = getenv("CUDA_DEVICE");
+    int device = choice && *choice ? atoi(choice) : 0;
+    if(device < 0 || device >= count) {
+      return nullptr;
+    }
+    return std::unique_ptr<Backend>(new CudaBackend(device));
+  }
+
+  ~CudaBackend() {
+    cudaStreamSynchronize(stream);
+    cudaEventDestroy(start);
+    cudaEventDestroy(stop);
+    cudaStreamDestroy(stream);
+  }
+
+  const char* name() const { return "cuda"; }
+
+  std::string deviceName() const {
+    cudaDeviceProp props;
+    cudaGetDeviceProperties(&props, device);
+    return props.name;
+  }
+
+  // the pool hands out no block when the device is full
+  std::unique_ptr<BackendBuffer> allocate(size_t bytes) {
+    std::unique_ptr<CudaBuffer> buffer(new CudaBuffer(bytes));
+    if(bytes > 0 && !buffer->data.get()) {
+      return nullptr;
+    }
+    return std::move(buffer);
+  }
+
+  std::unique_ptr<HostBuffer> allocateHost(size_t bytes) {
+    std::unique_ptr<CudaHostBuffer> buffer(new CudaHostBuffer(bytes));
+    if(!buffer->data()) {
+      return nullptr;
+    }
+    return std::move(buffer);
+  }
+
+  Status write(BackendBuffer& dst, const void* src, size_t bytes) {
+    Status status = check(cudaMemcpyAsync(ptr<void>(dst), src, bytes, cudaMemcpyHostToDevice, stream), "write");
+    return record(status.ok() ? check(cudaStreamSynchronize(stream), "write") : status);
+  }
+
+  Status read(void* dst, const BackendBuffer& src, size_t bytes) {
+    Status status = check(cudaMemcpyAsync(dst, ptr<void>(src), bytes, cudaMemcpyDeviceToHost, stream), "read");
+    return record(status.ok() ? check(cudaStreamSynchronize(stream), "read") : status);
+  }
+
+  BackendFuture writeAsync(BackendBuffer& dst, const void* src, size_t bytes) {
+    record(check(cudaMemcpyAsync(ptr<void>(dst), src, bytes, cudaMemcpyHostToDevice, stream), "writeAsync"));
+    return submit();
+  }
+
+  BackendFuture readAsync(void* dst, const BackendBuffer& src, size_t bytes) {
+    record(check(cudaMemcpyAsync(dst, ptr<void>(src), bytes, cudaMemcpyDeviceToHost, stream), "readAsync"));
+    return submit();
+  }
+
+  // a launch only reports a bad configuration right away, a fault shows in the next finish()
+  Status add(const BackendBuffer& a, const BackendBuffer& b, BackendBuffer& c, int n) {
+    backend_add_kernel<<<elementwise_blocks(n), ELEMENTWISE_THREADS, 0, stream>>>(ptr<int>(a), ptr<int>(b), ptr<int>(c), n);
+    return record(check(cudaGetLastError(), "add"));
+  }
+
+  Status square(const BackendBuffer& in, BackendBuffer& out, int n) {
+    transform(ptr<float>(out), ptr<float>(in), n, SquareOp(), stream);
+    return record(check(cudaGetLastError(), "square"));
+  }
+
+  // the shuffle reduction, with the intermediate kept between calls
+  Status reduceSum(const BackendBuffer& in, BackendBuffer& out, int n) {
+    size_t needed = reduce_intermediate_size(n);
+    if(intermediate.size() < needed) {
+      intermediate.reset(needed);
+      if(intermediate.size() < needed) {
+        return record(check(cudaErrorMemoryAllocation, "reduceSum"));
+      }
+    }
+    reduce(ptr<float>(out), intermediate.get(), ptr<float>(in), n, SHFL_REDUCE, SumOp<float>(), stream);
+    return record(check(cudaGetLastError(), "reduceSum"));
+  }
+
+  Status segmentedReduceSum(const BackendBuffer& in, const BackendBuffer& offsets, BackendBuffer& out, int segments) {
+    segmented_reduce(ptr<float>(out), ptr<float>(in), ptr<int>(offsets), segments, SumOp<float>(), stream);
+    return record(check(cudaGetLastError(), "segmentedReduceSum"));
+  }
+
+  // the callback runs once the stream gets to it, with the stream's error if it has one;
+  // cudaLaunchHostFunc would not pass that on. the future hands along the first enqueue
+  // error since the last submit(), if there was one
+  BackendFuture submit() {
+    Submission* submission = new Submission{ BackendFuture(), takePending() };
+    BackendFuture future = submission->future;
+    cudaError_t err = cudaStreamAddCallback(stream, onStreamDone, submission, 0);
+    if(err != cudaSuccess) {
+      future.complete(submission->enqueued.ok() ? check(err, "submit") : submission->enqueued);
+      delete submission;
+    }
+    return future;
+  }
+
+  Status finish() {
+    Status status = check(cudaStreamSynchronize(stream), "finish");
+    Status enqueued = takePending();
+    return enqueued.ok() ? status : enqueued;
+  }
+
+  void startTimer() {
+    cudaEventRecord(start, stream);
+  }
+
+  double stopTimer() {
+    float elapsed = 0;
+    cudaEventRecord(stop, stream);
+    cudaEventSynchronize(stop);
+    cudaEventElapsedTime(&elapsed, start, stop);
+    return elapsed;
+  }
+
+private:
+  // what the stream callback of submit() completes
+  struct Submission {
+    BackendFuture future;
+    Status enqueued;
+  };
+
+  static void CUDART_CB onStreamDone(cudaStream_t, cudaError_t err, void* data) {
+    std::unique_ptr<Submission> submission(static_cast<Submission*>(data));
+    submission->future.complete(submission->enqueued.ok() ? check(err, "stream") : submission->enqueued);
+  }
+
+  static Status check(cudaError_t err, const char* what) {
+    if(err == cudaSuccess) {
+      return Status::success();
+    }
+    return Status{ (int) err, std::string(what) + ": " + cudaGetErrorString(err) };
+  }
+
+  // keeps the first error until finish() or submit() report it
+  Status record(const Status& status) {
+    if(!status.ok() && pending.ok()) {
+      pending = status;
+    }
+    return status;
+  }
+
+  Status takePending() {
+    Status status = pending;
+    pending = Status::success();
+    return status;
+  }
+
+  explicit CudaBackend(int device) : device(device), pending(Status::success()) {
+    cudaSetDevice(device);
+    cudaStreamCreate(&stream);
+    cudaEventCreate(&start);
+    cudaEventCreate(&stop);
+  }
+
+  template <typename T>
+  static T* ptr(const BackendBuffer& buffer) {
+    return reinterpret_cast<T*>(static_cast<const CudaBuffer&>(buffer).data.get());
+  }
+
+  int device;
+  cudaStream_t stream;                  // blocking, so the legacy default stream waits for it
+  cudaEvent_t start, stop;
+  DeviceBuffer<float> intermediate;
+  Status pending;                       // The first enqueue error since the last finish() or submit().
+};
+
+#endif  /* __CUDA_BACKEND_H__ */
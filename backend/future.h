@@ -0,0 +1,131 @@
+#ifndef __FUTURE_H__
+#define __FUTURE_H__
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * the results of the asynchronous backend calls. a Status carries the error code of the API
+ * that failed (cudaError_t or cl_int, both 0 on success) and what failed; a BackendFuture
+ * completes with one once the device is done with the commands it stands for, and runs the
+ * callbacks handed to then() at that point. the backends complete futures from the driver's
+ * callback thread (cudaStreamAddCallback, clSetEventCallback), so a callback must be short
+ * and must not call the backend, or CUDA, itself; hand the work to another thread instead.
+ */
+
+struct Status {
+  int code;               // the API's error code, 0 on success
+  std::string message;    // the call that failed and why, empty on success
+
+  bool ok() const { return code == 0; }
+
+  static Status success() { return Status{ 0, "" }; }
+};
+
+class BackendFuture {
+public:
+  typedef std::function<void(const Status&)> Callback;
+
+  BackendFuture() : state(std::make_shared<State>()) {}
+
+  // a future that is already complete, e.g. for a call that failed before enqueueing anything
+  static BackendFuture completed(const Status& status) {
+    BackendFuture future;
+    future.complete(status);
+    return future;
+  }
+
+  // completes once every one of the futures has, with the first error among them; never
+  // blocks a callback thread, so it can join futures completed from different ones
+  static BackendFuture all(const std::vector<BackendFuture>& futures) {
+    BackendFuture joined;
+    if(futures.empty()) {
+      joined.complete(Status::success());
+      return joined;
+    }
+
+    struct Join {
+      std::mutex mutex;
+      size_t remaining;
+      Status status;
+    };
+    auto join = std::make_shared<Join>();
+    join->remaining = futures.size();
+    join->status = Status::success();
+    for(auto& future : futures) {
+      future.then([joined, join](const Status& status) {
+        std::unique_lock<std::mutex> lock(join->mutex);
+        if(!status.ok() && join->status.ok()) {
+          join->status = status;
+        }
+        if(--join->remaining == 0) {
+          Status result = join->status;
+          lock.unlock();
+          joined.complete(result);
+        }
+      });
+    }
+    return joined;
+  }
+
+  bool ready() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->done;
+  }
+
+  // blocks until the future completes
+  Status wait() const {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->completion.wait(lock, [this] { return state->done; });
+    return state->status;
+  }
+
+  // runs callback(status) once the future completes, or right away when it already has
+  void then(Callback callback) const {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if(!state->done) {
+      state->callbacks.push_back(std::move(callback));
+      return;
+    }
+    Status status = state->status;
+    lock.unlock();
+    callback(status);
+  }
+
+  // for the backends: the commands are done; the first completion counts
+  void complete(const Status& status) const {
+    std::vector<Callback> callbacks;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if(state->done) {
+        return;
+      }
+      state->done = true;
+      state->status = status;
+      callbacks.swap(state->callbacks);
+    }
+    state->completion.notify_all();
+    for(auto& callback : callbacks) {
+      callback(status);
+    }
+  }
+
+private:
+  // shared by the copies of a future, so the driver's callback can hold one of its own
+  struct State {
+    std::mutex mutex;
+    std::condition_variable completion;
+    bool done = false;
+    Status status = Status::success();
+    std::vector<Callback> callbacks;
+  };
+
+  std::shared_ptr<State> state;
+};
+
+#endif  /* __FUTURE_H__ */
@@ -0,0 +1,85 @@
+// the kernels of the OpenCL backend: grid-stride loops, so any global size covers any n
+
+// c = a + b one int4 per step, the same kernel as vector_add/add.cl
+__kernel void add(__global const int* a, __global const int* b, __global int* c, const int n) {
+
+  int vecs = n / 4;
+  for(int i = get_global_id(0); i < vecs; i += get_global_size(0)) {
+    vstore4(vload4(i, a) + vload4(i, b), i, c);
+  }
+
+  int tail = vecs * 4 + get_global_id(0);
+  if(tail < n) {
+    c[tail] = a[tail] + b[tail];
+  }
+}
+
+// out = in * in one float4 per step, the same as cuda/elementwise.h with SquareOp
+__kernel void square(__global const float* in, __global float* out, const int n) {
+
+  int vecs = n / 4;
+  for(int i = get_global_id(0); i < vecs; i += get_global_size(0)) {
+    float4 v = vload4(i, in);
+    vstore4(v * v, i, out);
+  }
+
+  int tail = vecs * 4 + get_global_id(0);
+  if(tail < n) {
+    out[tail] = in[tail] * in[tail];
+  }
+}
+
+// one partial sum per work-group: every work-item sums its grid-stride share, then the group
+// combines them in a tree in local memory. the local size must be a power of two
+__kernel void reduce_sum(__global const float* in, __global float* partials, const int n, __local float* scratch) {
+
+  float sum = 0.0f;
+  for(int i = get_global_id(0); i < n; i += get_global_size(0)) {
+    sum += in[i];
+  }
+
+  int lid = get_local_id(0);
+  scratch[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if(lid < s) {
+      scratch[lid] += scratch[lid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if(lid == 0) {
+    partials[get_group_id(0)] = scratch[0];
+  }
+}
+
+// one work-group per segment: group s sums in[offsets[s]] up to offsets[s + 1] into out[s].
+// the local size must be a power of two
+__kernel void segmented_reduce_sum(__global const float* in, __global const int* offsets, __global float* out,
+                                   const int segments, __local float* scratch) {
+
+  int lid = get_local_id(0);
+  for(int s = get_group_id(0); s < segments; s += get_num_groups(0)) {
+    float sum = 0.0f;
+    for(int i = offsets[s] + lid; i < offsets[s + 1]; i += get_local_size(0)) {
+      sum += in[i];
+    }
+
+    scratch[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(int k = get_local_size(0) / 2; k > 0; k >>= 1) {
+      if(lid < k) {
+        scratch[lid] += scratch[lid + k];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(lid == 0) {
+      out[s] = scratch[0];
+    }
+    // the next segment of the group reuses the scratch
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
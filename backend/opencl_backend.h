@@ -0,0 +1,284 @@
+#ifndef __OPENCL_BACKEND_H__
+#define __OPENCL_BACKEND_H__
+
+#include <CL/cl.hpp>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "backend.h"
+#include "../opencl/device.h"
+#include "../opencl/program_cache.h"
+
+
+class OpenCLBuffer : public BackendBuffer {
+public:
+  OpenCLBuffer(const cl::Context& context, size_t bytes, cl_int* err = nullptr)
+    : buffer(context, CL_MEM_READ_WRITE, std::max<size_t>(bytes, 1), nullptr, err), size(bytes) {}
+  size_t bytes() const { return size; }
+
+  cl::Buffer buffer;
+  size_t size;
+};
+
+
+// a buffer the driver allocates in host memory, mapped for as long as it lives; the driver
+// pins such memory, so copies from and to the mapped pointer can run without staging
+class OpenCLHostBuffer : public HostBuffer {
+public:
+  OpenCLHostBuffer(const cl::Context& context, const cl::CommandQueue& queue, size_t bytes, cl_int* err)
+    : queue(queue), buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, std::max<size_t>(bytes, 1), nullptr, err),
+      size(bytes), ptr(nullptr) {
+    if(*err == CL_SUCCESS) {
+      ptr = this->queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, std::max<size_t>(bytes, 1),
+                                         nullptr, nullptr, err);
+    }
+  }
+
+  ~OpenCLHostBuffer() {
+    if(ptr) {
+      queue.enqueueUnmapMemObject(buffer, ptr);
+    }
+  }
+
+  void* data() { return ptr; }
+  size_t bytes() const { return size; }
+
+private:
+  cl::CommandQueue queue;
+  cl::Buffer buffer;
+  size_t size;
+  void* ptr;
+};
+
+
+// the kernels of kernels.cl, on the device Devices::select() picks
+class OpenCLBackend : public Backend {
+public:
+  // nullptr when no platform has a device
+  static std::unique_ptr<Backend> create(const std::string& src) {
+    if(Devices::ranked().empty()) {
+      return nullptr;
+    }
+    return std::unique_ptr<Backend>(new OpenCLBackend(Devices::select(), src));
+  }
+
+  const char* name() const { return "opencl"; }
+  std::string deviceName() const { return device.getInfo<CL_DEVICE_NAME>(); }
+
+  // drivers allocate lazily, so running out of memory usually shows at the first command instead
+  std::unique_ptr<BackendBuffer> allocate(size_t bytes) {
+    cl_int err;
+    std::unique_ptr<OpenCLBuffer> buffer(new OpenCLBuffer(context, bytes, &err));
+    if(err != CL_SUCCESS) {
+      return nullptr;
+    }
+    return std::move(buffer);
+  }
+
+  std::unique_ptr<HostBuffer> allocateHost(size_t bytes) {
+    cl_int err;
+    std::unique_ptr<OpenCLHostBuffer> buffer(new OpenCLHostBuffer(context, queue, bytes, &err));
+    if(err != CL_SUCCESS || !buffer->data()) {
+      return nullptr;
+    }
+    return std::move(buffer);
+  }
+
+  Status write(BackendBuffer& dst, const void* src, size_t bytes) {
+    return record(check(queue.enqueueWriteBuffer(buf(dst), CL_TRUE, 0, bytes, src, nullptr, track()), "write"));
+  }
+
+  Status read(void* dst, const BackendBuffer& src, size_t bytes) {
+    return record(check(queue.enqueueReadBuffer(buf(src), CL_TRUE, 0, bytes, dst, nullptr, track()), "read"));
+  }
+
+  BackendFuture writeAsync(BackendBuffer& dst, const void* src, size_t bytes) {
+    record(check(queue.enqueueWriteBuffer(buf(dst), CL_FALSE, 0, bytes, src, nullptr, track()), "writeAsync"));
+    return submit();
+  }
+
+  BackendFuture readAsync(void* dst, const BackendBuffer& src, size_t bytes) {
+    record(check(queue.enqueueReadBuffer(buf(src), CL_FALSE, 0, bytes, dst, nullptr, track()), "readAsync"));
+    return submit();
+  }
+
+  Status add(const BackendBuffer& a, const BackendBuffer& b, BackendBuffer& c, int n) {
+    addKernel.setArg(0, buf(a));
+    addKernel.setArg(1, buf(b));
+    addKernel.setArg(2, buf(c));
+    addKernel.setArg(3, n);
+    return record(check(queue.enqueueNDRangeKernel(addKernel, cl::NullRange, vectorRange(n), cl::NullRange, nullptr, track()), "add"));
+  }
+
+  Status square(const BackendBuffer& in, BackendBuffer& out, int n) {
+    squareKernel.setArg(0, buf(in));
+    squareKernel.setArg(1, buf(out));
+    squareKernel.setArg(2, n);
+    return record(check(queue.enqueueNDRangeKernel(squareKernel, cl::NullRange, vectorRange(n), cl::NullRange, nullptr, track()), "square"));
+  }
+
+  // two passes: at most reduceLocal work-groups leave their partials, which one group combines
+  Status reduceSum(const BackendBuffer& in, BackendBuffer& out, int n) {
+    int groups = std::max(1, std::min(reduceLocal, (n + reduceLocal * ITEMS_PER_WORK_ITEM - 1) / (reduceLocal * ITEMS_PER_WORK_ITEM)));
+    Status status = reducePass(buf(in), groups == 1 ? buf(out) : partials, n, groups);
+    if(status.ok() && groups > 1) {
+      status = reducePass(partials, buf(out), groups, 1);
+    }
+    return record(status);
+  }
+
+  // one work-group per segment, at most MAX_SEGMENT_GROUPS; groups loop over the rest
+  Status segmentedReduceSum(const BackendBuffer& in, const BackendBuffer& offsets, BackendBuffer& out, int segments) {
+    if(segments <= 0) {
+      return Status::success();
+    }
+    int groups = std::min(segments, (int) MAX_SEGMENT_GROUPS);
+    segmentedKernel.setArg(0, buf(in));
+    segmentedKernel.setArg(1, buf(offsets));
+    segmentedKernel.setArg(2, buf(out));
+    segmentedKernel.setArg(3, segments);
+    segmentedKernel.setArg(4, cl::Local(reduceLocal * sizeof(float)));
+    return record(check(queue.enqueueNDRangeKernel(segmentedKernel, cl::NullRange, cl::NDRange(groups * reduceLocal),
+                                                   cl::NDRange(reduceLocal), nullptr, track()), "segmentedReduceSum"));
+  }
+
+  // a marker after everything enqueued so far; its callback gets the execution status, which
+  // is negative when a command before it failed. the flush makes sure the queue reaches it
+  BackendFuture submit() {
+    BackendFuture future;
+    Status enqueued = takePending();
+    cl::Event marker;
+    cl_int err = queue.enqueueMarkerWithWaitList(nullptr, &marker);
+    if(err == CL_SUCCESS) {
+      Submission* submission = new Submission{ future, enqueued };
+      err = marker.setCallback(CL_COMPLETE, onMarkerDone, submission);
+      if(err != CL_SUCCESS) {
+        delete submission;
+      }
+    }
+    if(err != CL_SUCCESS) {
+      future.complete(enqueued.ok() ? check(err, "submit") : enqueued);
+    }
+    queue.flush();
+    return future;
+  }
+
+  Status finish() {
+    Status status = check(queue.finish(), "finish");
+    Status enqueued = takePending();
+    return enqueued.ok() ? status : enqueued;
+  }
+
+  void startTimer() {
+    events.clear();
+    timing = true;
+  }
+
+  // from the START of the first command to the END of the last; the queue is in order
+  double stopTimer() {
+    timing = false;
+    if(events.empty()) {
+      return 0;
+    }
+    events.back().wait();
+    return (events.back().getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+            events.front().getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1e6;
+  }
+
+private:
+  static const int ITEMS_PER_WORK_ITEM = 8;     // Elements each work-item of the first reduce pass sums.
+  static const int MAX_SEGMENT_GROUPS = 65535;  // Work-groups of one segmented reduction.
+
+  // what the marker callback of submit() completes
+  struct Submission {
+    BackendFuture future;
+    Status enqueued;
+  };
+
+  static void CL_CALLBACK onMarkerDone(cl_event, cl_int executionStatus, void* data) {
+    std::unique_ptr<Submission> submission(static_cast<Submission*>(data));
+    submission->future.complete(submission->enqueued.ok() ? check(executionStatus, "queue") : submission->enqueued);
+  }
+
+  static Status check(cl_int err, const char* what) {
+    if(err == CL_SUCCESS) {
+      return Status::success();
+    }
+    return Status{ err, std::string(what) + ": OpenCL error " + std::to_string(err) };
+  }
+
+  // keeps the first error until finish() or submit() report it
+  Status record(const Status& status) {
+    if(!status.ok() && pending.ok()) {
+      pending = status;
+    }
+    return status;
+  }
+
+  Status takePending() {
+    Status status = pending;
+    pending = Status::success();
+    return status;
+  }
+
+  OpenCLBackend(const cl::Device& device, const std::string& src)
+    : device(device), context(device), queue(context, device, CL_QUEUE_PROFILING_ENABLE), timing(false),
+      pending(Status::success()) {
+    program = ProgramCache::build(context, device, src);
+    addKernel = cl::Kernel(program, "add");
+    squareKernel = cl::Kernel(program, "square");
+    reduceKernel = cl::Kernel(program, "reduce_sum");
+    segmentedKernel = cl::Kernel(program, "segmented_reduce_sum");
+
+    // the tree needs a power of two
+    int maxLocal = (int) std::min<size_t>(256, std::min(reduceKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+                                                        segmentedKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)));
+    reduceLocal = 1;
+    while(reduceLocal * 2 <= maxLocal) {
+      reduceLocal *= 2;
+    }
+    partials = cl::Buffer(context, CL_MEM_READ_WRITE, reduceLocal * sizeof(float));
+  }
+
+  Status reducePass(const cl::Buffer& in, const cl::Buffer& out, int n, int groups) {
+    reduceKernel.setArg(0, in);
+    reduceKernel.setArg(1, out);
+    reduceKernel.setArg(2, n);
+    reduceKernel.setArg(3, cl::Local(reduceLocal * sizeof(float)));
+    return check(queue.enqueueNDRangeKernel(reduceKernel, cl::NullRange, cl::NDRange(groups * reduceLocal),
+                                            cl::NDRange(reduceLocal), nullptr, track()), "reduceSum");
+  }
+
+  // one work-item per vector of 4, but at least enough for the scalar tail of up to 3 elements
+  static cl::NDRange vectorRange(int n) {
+    return cl::NDRange(std::max(n / 4, 4));
+  }
+
+  static const cl::Buffer& buf(const BackendBuffer& buffer) {
+    return static_cast<const OpenCLBuffer&>(buffer).buffer;
+  }
+
+  cl::Event* track() {
+    if(!timing) {
+      return nullptr;
+    }
+    events.push_back(cl::Event());
+    return &events.back();
+  }
+
+  cl::Device device;
+  cl::Context context;
+  cl::CommandQueue queue;
+  cl::Program program;
+  cl::Kernel addKernel, squareKernel, reduceKernel, segmentedKernel;
+  int reduceLocal;                              // Work-group size of both reductions, a power of two.
+  cl::Buffer partials;                          // One partial per work-group of the first pass.
+
+  bool timing;
+  std::vector<cl::Event> events;                // Of the commands since startTimer().
+  Status pending;                               // The first enqueue error since the last finish() or submit().
+};
+
+#endif  /* __OPENCL_BACKEND_H__ */
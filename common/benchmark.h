@@ -0,0 +1,180 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+ * statistical benchmark harness shared by the CUDA and OpenCL samples. a measurement runs a
+ * few untimed warmup repetitions, then times every one of N repetitions on its own, and
+ * reports the min, median, p95, mean and standard deviation of their times. with the bytes
+ * and elements one repetition moves, it also reports the effective bandwidth and throughput,
+ * both from the median.
+ * results are printed, and appended to the file named by $BENCH_CSV, and to the one named by
+ * $BENCH_JSON as one JSON object per line. $BENCH_WARMUP and $BENCH_REPETITIONS override the
+ * counts of every measurement that did not set its own.
+ * the harness only sees milliseconds: the sample times one repetition however fits its API,
+ * with cuda events, opencl profiling or the host clock (see wallTime()).
+ */
+
+struct BenchmarkResult {
+  std::string sample;           // the program, e.g. "reduce"
+  std::string name;             // what was measured in it, e.g. "shfl/sum/kernels"
+  double bytes;                 // bytes one repetition reads and writes
+  double elements;              // elements one repetition processes
+  int warmup;
+  std::vector<double> times;    // ms of every timed repetition, sorted
+  double min, median, p95, mean, stddev;
+
+  double gbPerSecond() const       { return median > 0 ? bytes / median / 1e6 : 0; }
+  double elementsPerSecond() const { return median > 0 ? elements / median * 1e3 : 0; }
+};
+
+// host wall time of one call of f, in ms
+template <typename F>
+double wallTime(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+class Benchmark {
+public:
+  static const int DEFAULT_WARMUP = 3;
+  static const int DEFAULT_REPETITIONS = 20;
+
+  Benchmark(const std::string& sample, const std::string& name)
+    : sample(sample), name(name), bytesPerRun(0), elementsPerRun(0),
+      warmupRuns(envCount("BENCH_WARMUP", DEFAULT_WARMUP, 0)),
+      timedRuns(envCount("BENCH_REPETITIONS", DEFAULT_REPETITIONS, 1)) {}
+
+  Benchmark& bytes(double b)      { bytesPerRun = b; return *this; }
+  Benchmark& elements(double e)   { elementsPerRun = e; return *this; }
+  Benchmark& warmup(int n)        { warmupRuns = std::max(n, 0); return *this; }
+  Benchmark& repetitions(int n)   { timedRuns = std::max(n, 1); return *this; }
+
+  // timeOne() does one repetition and returns how long it took, in ms
+  template <typename F>
+  BenchmarkResult run(F timeOne) const {
+    for(int i = 0; i < warmupRuns; i++) {
+      timeOne();
+    }
+
+    std::vector<double> times;
+    for(int i = 0; i < timedRuns; i++) {
+      times.push_back(timeOne());
+    }
+    return record(times);
+  }
+
+  // for a measurement the sample already made, e.g. one that cannot be repeated
+  BenchmarkResult record(std::vector<double> times) const {
+    BenchmarkResult r;
+    r.sample = sample;
+    r.name = name;
+    r.bytes = bytesPerRun;
+    r.elements = elementsPerRun;
+    r.warmup = warmupRuns;
+    r.times = times;
+    summarize(r);
+    report(r);
+    return r;
+  }
+
+private:
+  // the count in the environment, or "fallback" when it is unset; never below "least"
+  static int envCount(const char* variable, int fallback, int least) {
+    const char* value = getenv(variable);
+    return value && *value ? std::max(atoi(value), least) : fallback;
+  }
+
+  // the p95 is the nearest-rank percentile, the standard deviation the sample one
+  static void summarize(BenchmarkResult& r) {
+    std::sort(r.times.begin(), r.times.end());
+    size_t n = r.times.size();
+    if(n == 0) {
+      r.min = r.median = r.p95 = r.mean = r.stddev = 0;
+      return;
+    }
+
+    r.min = r.times.front();
+    r.median = n % 2 ? r.times[n / 2] : (r.times[n / 2 - 1] + r.times[n / 2]) / 2;
+    r.p95 = r.times[(size_t) std::ceil(0.95 * n) - 1];
+
+    double sum = 0;
+    for(double t : r.times) {
+      sum += t;
+    }
+    r.mean = sum / n;
+
+    double squares = 0;
+    for(double t : r.times) {
+      squares += (t - r.mean) * (t - r.mean);
+    }
+    r.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+  }
+
+  static std::string escape(const std::string& s) {
+    std::string out;
+    for(char c : s) {
+      if(c == '"' || c == '\\') {
+        out += '\\';
+      }
+      out += c;
+    }
+    return out;
+  }
+
+  static void report(const BenchmarkResult& r) {
+    printf("[%s] %s: median %f ms, min %f, p95 %f, stddev %f over %d runs",
+           r.sample.c_str(), r.name.c_str(), r.median, r.min, r.p95, r.stddev, (int) r.times.size());
+    if(r.bytes > 0) {
+      printf(", %f GB/s", r.gbPerSecond());
+    }
+    if(r.elements > 0) {
+      printf(", %g elem/s", r.elementsPerSecond());
+    }
+    printf("\n");
+
+    const char* csv = getenv("BENCH_CSV");
+    if(csv && *csv) {
+      FILE* file = fopen(csv, "a");
+      if(file) {
+        // a new file gets the header first
+        fseek(file, 0, SEEK_END);
+        if(ftell(file) == 0) {
+          fprintf(file, "sample,name,warmup,repetitions,min_ms,median_ms,p95_ms,mean_ms,stddev_ms,"
+                        "bytes,elements,gb_per_s,elements_per_s\n");
+        }
+        fprintf(file, "%s,%s,%d,%d,%f,%f,%f,%f,%f,%.0f,%.0f,%f,%f\n",
+                r.sample.c_str(), r.name.c_str(), r.warmup, (int) r.times.size(), r.min, r.median, r.p95,
+                r.mean, r.stddev, r.bytes, r.elements, r.gbPerSecond(), r.elementsPerSecond());
+        fclose(file);
+      }
+    }
+
+    const char* json = getenv("BENCH_JSON");
+    if(json && *json) {
+      FILE* file = fopen(json, "a");
+      if(file) {
+        fprintf(file, "{\"sample\": \"%s\", \"name\": \"%s\", \"warmup\": %d, \"repetitions\": %d, "
+                      "\"min_ms\": %f, \"median_ms\": %f, \"p95_ms\": %f, \"mean_ms\": %f, \"stddev_ms\": %f, "
+                      "\"bytes\": %.0f, \"elements\": %.0f, \"gb_per_s\": %f, \"elements_per_s\": %f}\n",
+                escape(r.sample).c_str(), escape(r.name).c_str(), r.warmup, (int) r.times.size(), r.min,
+                r.median, r.p95, r.mean, r.stddev, r.bytes, r.elements, r.gbPerSecond(), r.elementsPerSecond());
+        fclose(file);
+      }
+    }
+  }
+
+  std::string sample, name;
+  double bytesPerRun, elementsPerRun;
+  int warmupRuns, timedRuns;
+};
+
+#endif  /* __BENCHMARK_H__ */
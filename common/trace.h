@@ -0,0 +1,209 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * phase instrumentation shared by the CUDA and OpenCL samples, compiled in with -DTRACE.
+ * TRACE_RANGE() marks a host scope as allocation, transfer, kernel or verification work; in
+ * a CUDA build it is also an NVTX range, so Nsight shows the phases. the OpenCL samples add
+ * the commands of their profiling events as device ranges (opencl/cltrace.h). every phase
+ * keeps its counters: ranges and their time, kernel launches and bytes moved.
+ * TRACE_DUMP() prints the counters and writes every range as a Chrome trace, to $TRACE_FILE
+ * or trace.json, which chrome://tracing and ui.perfetto.dev open.
+ * without -DTRACE the macros expand to nothing and their arguments are never evaluated
+ */
+
+enum TracePhase { TRACE_ALLOCATION, TRACE_TRANSFER, TRACE_KERNEL, TRACE_VERIFICATION, TRACE_PHASES };
+
+#ifdef TRACE
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef __CUDACC__
+#include <nvtx3/nvToolsExt.h>
+#endif
+
+class Tracer {
+public:
+  static Tracer& instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  static const char* phaseName(TracePhase phase) {
+    static const char* names[TRACE_PHASES] = { "allocation", "transfer", "kernel", "verification" };
+    return names[phase];
+  }
+
+  // us since the tracer was first used
+  double now() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+  }
+
+  void hostRange(const char* name, TracePhase phase, double start, double duration, double bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Range range = { name, phase, HOST_TRACK, start, duration, bytes };
+    ranges.push_back(range);
+    counters[phase].hostRanges++;
+    counters[phase].hostUs += duration;
+    counters[phase].bytes += bytes;
+  }
+
+  // a command that has already run, with its start on the tracer's clock and its duration, in
+  // us; a kernel counts as a launch
+  void deviceRange(const char* name, TracePhase phase, double bytes, double start, double duration) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Range range = { name, phase, DEVICE_TRACK, start, duration, bytes };
+    ranges.push_back(range);
+    counters[phase].deviceRanges++;
+    counters[phase].deviceUs += duration;
+    counters[phase].bytes += bytes;
+    if(phase == TRACE_KERNEL) {
+      counters[phase].launches++;
+    }
+  }
+
+  // runs "hook" at the start of every dump(), e.g. to add the commands still in flight
+  void onDump(std::function<void()> hook) {
+    std::lock_guard<std::mutex> lock(mutex);
+    hooks.push_back(hook);
+  }
+
+  void launches(int n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[TRACE_KERNEL].launches += n;
+  }
+
+  void bytes(TracePhase phase, double n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[phase].bytes += n;
+  }
+
+  // runs the hooks, prints the counters and writes the trace
+  void dump() {
+    std::vector<std::function<void()>> run;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      run = hooks;
+    }
+    for(auto& hook : run) {
+      hook();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    printf("trace:\n");
+    for(int p = 0; p < TRACE_PHASES; p++) {
+      const Counters& c = counters[p];
+      printf("\t%-12s host %d ranges, %f ms; device %d commands, %f ms; %d launches, %.0f bytes\n",
+             phaseName((TracePhase) p), c.hostRanges, c.hostUs / 1e3, c.deviceRanges, c.deviceUs / 1e3,
+             c.launches, c.bytes);
+    }
+
+    const char* path = getenv("TRACE_FILE");
+    path = path && *path ? path : "trace.json";
+    FILE* file = fopen(path, "w");
+    if(!file) {
+      fprintf(stderr, "cannot write the trace to %s\n", path);
+      return;
+    }
+    fprintf(file, "{\"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"host\"}},\n", HOST_TRACK);
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"device\"}}", DEVICE_TRACK);
+    for(auto& range : ranges) {
+      fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"bytes\": %.0f}}",
+              escape(range.name).c_str(), phaseName(range.phase), range.track, range.start, range.duration, range.bytes);
+    }
+    fprintf(file, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    fclose(file);
+    printf("trace of %d ranges written to %s\n", (int) ranges.size(), path);
+  }
+
+private:
+  enum { HOST_TRACK = 0, DEVICE_TRACK = 1 };    // The tids of the trace.
+
+  struct Range {
+    std::string name;
+    TracePhase phase;
+    int track;
+    double start, duration, bytes;
+  };
+
+  struct Counters {
+    int hostRanges = 0, deviceRanges = 0, launches = 0;
+    double hostUs = 0, deviceUs = 0, bytes = 0;
+  };
+
+  Tracer() : origin(std::chrono::steady_clock::now()) {}
+
+  static std::string escape(const std::string& s) {
+    std::string out;
+    for(char c : s) {
+      if(c == '"' || c == '\\') {
+        out += '\\';
+      }
+      out += c;
+    }
+    return out;
+  }
+
+  std::chrono::steady_clock::time_point origin;
+  std::mutex mutex;
+  std::vector<Range> ranges;
+  std::vector<std::function<void()>> hooks;
+  Counters counters[TRACE_PHASES];
+};
+
+// a host range from construction to the end of the scope, nested in NVTX too under nvcc
+class TraceRange {
+public:
+  TraceRange(const char* name, TracePhase phase, double bytes = 0)
+    : name(name), phase(phase), bytes(bytes), start(Tracer::instance().now()) {
+#ifdef __CUDACC__
+    nvtxRangePushA(name);
+#endif
+  }
+
+  ~TraceRange() {
+#ifdef __CUDACC__
+    nvtxRangePop();
+#endif
+    Tracer& tracer = Tracer::instance();
+    tracer.hostRange(name, phase, start, tracer.now() - start, bytes);
+  }
+
+private:
+  TraceRange(const TraceRange&);
+  TraceRange& operator=(const TraceRange&);
+
+  const char* name;
+  TracePhase phase;
+  double bytes;
+  double start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_RANGE(name, phase)              TraceRange TRACE_CONCAT(traceRange, __LINE__)(name, phase)
+#define TRACE_RANGE_BYTES(name, phase, bytes) TraceRange TRACE_CONCAT(traceRange, __LINE__)(name, phase, bytes)
+#define TRACE_LAUNCHES(n)                     Tracer::instance().launches(n)
+#define TRACE_BYTES(phase, n)                 Tracer::instance().bytes(phase, n)
+#define TRACE_DUMP()                          Tracer::instance().dump()
+
+#else
+
+#define TRACE_RANGE(name, phase)              ((void) 0)
+#define TRACE_RANGE_BYTES(name, phase, bytes) ((void) 0)
+#define TRACE_LAUNCHES(n)                     ((void) 0)
+#define TRACE_BYTES(phase, n)                 ((void) 0)
+#define TRACE_DUMP()                          ((void) 0)
+
+#endif  /* TRACE */
+
+#endif  /* __TRACE_H__ */
@@ -0,0 +1,181 @@
+#ifndef __TUNING_H__
+#define __TUNING_H__
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+ * launch configuration autotuning shared by the CUDA and OpenCL samples. autotune() times a
+ * kernel over a sweep of block (work-group) sizes and elements per thread, starting from what
+ * the API suggests, and remembers the fastest configuration in the tuning file of the device,
+ * so that later runs load the winner at startup instead of sweeping again.
+ * a tuning file is plain text, one "key block_size items_per_thread ms" line per kernel, in
+ * $TUNING_DIR or .tuning in the working directory. $AUTOTUNE=0 skips tuning and uses the
+ * built-in defaults, $AUTOTUNE=1 sweeps again even when the file has an entry.
+ */
+
+struct LaunchConfig {
+  int blockSize;          // threads per block, or work-items per work-group
+  int itemsPerThread;     // elements, or vectors of them, each thread covers
+};
+
+class TuningFile {
+public:
+  // the entries of the device named "device", which can be anything that tells devices apart
+  explicit TuningFile(const std::string& device) : filePath(directory() + "/" + fileName(device)) {
+    load();
+  }
+
+  bool find(const std::string& key, LaunchConfig& config) const {
+    auto it = entries.find(key);
+    if(it == entries.end()) {
+      return false;
+    }
+    config = it->second.config;
+    return true;
+  }
+
+  // remembers the configuration and rewrites the file right away
+  void store(const std::string& key, const LaunchConfig& config, double ms) {
+    Entry entry = { config, ms };
+    entries[key] = entry;
+    save();
+  }
+
+  const std::string& path() const { return filePath; }
+
+private:
+  struct Entry {
+    LaunchConfig config;
+    double ms;
+  };
+
+  static std::string directory() {
+    const char* dir = getenv("TUNING_DIR");
+    return dir && *dir ? dir : ".tuning";
+  }
+
+  // device names have spaces and worse in them
+  static std::string fileName(const std::string& device) {
+    std::string name;
+    for(char c : device) {
+      bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-';
+      name += plain ? c : '_';
+    }
+    return name + ".txt";
+  }
+
+  // a missing or partly unreadable file is just a miss for the keys it lacks
+  void load() {
+    std::ifstream file(filePath);
+    std::string line;
+    while(std::getline(file, line)) {
+      if(line.empty() || line[0] == '#') {
+        continue;
+      }
+      std::istringstream fields(line);
+      std::string key;
+      Entry entry;
+      if(fields >> key >> entry.config.blockSize >> entry.config.itemsPerThread >> entry.ms &&
+         entry.config.blockSize > 0 && entry.config.itemsPerThread > 0) {
+        entries[key] = entry;
+      }
+    }
+  }
+
+  // tuning is an optimization, so a directory or file that cannot be written is not an error
+  void save() const {
+    mkdir(directory().c_str(), 0755);
+    std::ofstream file(filePath, std::ios::trunc);
+    file << "# key block_size items_per_thread ms\n";
+    for(auto& entry : entries) {
+      file << entry.first << " " << entry.second.config.blockSize << " " << entry.second.config.itemsPerThread
+           << " " << entry.second.ms << "\n";
+    }
+  }
+
+  std::string filePath;
+  std::map<std::string, Entry> entries;
+};
+
+// the key of a kernel run on about n elements. the best shape depends on the size, so sizes
+// within a factor of two share an entry
+inline std::string tuningKey(const std::string& kernel, long long n) {
+  int log2 = 0;
+  while((1LL << (log2 + 1)) <= n) {
+    log2++;
+  }
+  std::ostringstream key;
+  key << kernel << "/n=2^" << log2;
+  return key.str();
+}
+
+// block sizes to sweep: the multiples of "multiple" that double from it up to maxSize, with
+// the size the API suggested among them (rounded down to a multiple)
+inline std::vector<int> blockSizeCandidates(int suggested, int multiple, int maxSize) {
+  multiple = std::max(multiple, 1);
+  std::vector<int> sizes;
+  for(int size = multiple; size <= maxSize; size *= 2) {
+    sizes.push_back(size);
+  }
+  suggested = suggested / multiple * multiple;
+  if(suggested > 0 && suggested <= maxSize) {
+    sizes.push_back(suggested);
+  }
+  std::sort(sizes.begin(), sizes.end());
+  sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+  return sizes;
+}
+
+// the configuration of "key": from the tuning file when it has one, otherwise the fastest of
+// every block size and items per thread pair. timeOne(config) runs the kernel once with that
+// configuration and returns its time in ms, or a negative time when the configuration cannot
+// run; each pair gets a warmup run, then the best of a few counts
+template <typename F>
+LaunchConfig autotune(TuningFile& file, const std::string& key, const std::vector<int>& blockSizes,
+                      const std::vector<int>& items, const LaunchConfig& fallback, F timeOne) {
+  const char* mode = getenv("AUTOTUNE");
+  if(mode && std::string(mode) == "0") {
+    return fallback;
+  }
+
+  LaunchConfig best = fallback;
+  if(!(mode && std::string(mode) == "1") && file.find(key, best)) {
+    return best;
+  }
+
+  const int RUNS = 5;
+  double bestTime = -1;
+  for(int blockSize : blockSizes) {
+    for(int itemsPerThread : items) {
+      LaunchConfig config = { blockSize, itemsPerThread };
+      if(timeOne(config) < 0) {
+        continue;
+      }
+      double time = timeOne(config);
+      for(int i = 1; i < RUNS; i++) {
+        time = std::min(time, timeOne(config));
+      }
+      if(bestTime < 0 || time < bestTime) {
+        best = config;
+        bestTime = time;
+      }
+    }
+  }
+
+  if(bestTime >= 0) {
+    file.store(key, best, bestTime);
+    printf("tuned %s: %d threads, %d per thread, %f ms (saved to %s)\n",
+           key.c_str(), best.blockSize, best.itemsPerThread, bestTime, file.path().c_str());
+  }
+  return best;
+}
+
+#endif  /* __TUNING_H__ */
@@ -1,29 +1,35 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/benchmark.h"
+#include "../common/trace.h"
+#include "autotune.h"
 #include "gputimer.h"
+#include "histogram.h"
 
 #define NUM_THREADS 1000000
 #define ARRAY_SIZE  100
 
-#define BLOCK_WIDTH 1000
-
 void print_array(int *array, int size) {
   printf("{ ");
   for (int i = 0; i < size; i++)  { printf("%d ", array[i]); }
   printf("}\n");
 }
 
-__global__ void increment_naive(int *g) {
-	// which thread is this?
+__global__ void increment_naive(int *g, int n) {
+	// which thread is this? the last block may have more threads than are left
 	int i = blockIdx.x * blockDim.x + threadIdx.x; 
+	if (i >= n) return;
 
 	// each thread to increment consecutive elements, wrapping at ARRAY_SIZE
 	i = i % ARRAY_SIZE;  
 	g[i] = g[i] + 1;
 }
 
-__global__ void increment_atomic(int *g) {
-	// which thread is this?
+__global__ void increment_atomic(int *g, int n) {
+	// which thread is this? the last block may have more threads than are left
 	int i = blockIdx.x * blockDim.x + threadIdx.x; 
+	if (i >= n) return;
 
 	// each thread to increment consecutive elements, wrapping at ARRAY_SIZE
 	i = i % ARRAY_SIZE;  
@@ -32,30 +38,150 @@ __global__ void increment_atomic(int *g) {
 
 int main(int argc,char **argv) { 
   GpuTimer timer;
-  printf("%d total threads in %d blocks writing into %d array elements\n",
-         NUM_THREADS, NUM_THREADS / BLOCK_WIDTH, ARRAY_SIZE);
 
   // declare and allocate host memory
   int h_array[ARRAY_SIZE];
   const int ARRAY_BYTES = ARRAY_SIZE * sizeof(int);
  
-  // declare, allocate, and zero out GPU memory
+  // declare and allocate GPU memory
   int * d_array;
-  cudaMalloc((void **) &d_array, ARRAY_BYTES);
+  {
+    TRACE_RANGE_BYTES("cudaMalloc", TRACE_ALLOCATION, ARRAY_BYTES);
+    cudaMalloc((void **) &d_array, ARRAY_BYTES);
+  }
+
+  // the block width for this device, from its tuning file or swept now; every thread does
+  // one increment, so there is nothing to tune per thread
+  TuningFile tuning(device_tuning_name(0));
+  LaunchConfig fallback = { 256, 1 };
+  LaunchConfig launch = autotune(tuning, tuningKey("atomics/increment_atomic", NUM_THREADS),
+                                 block_size_candidates(increment_atomic), { 1 }, fallback,
+                                 [&](const LaunchConfig &candidate) {
+                                   timer.Start();
+                                   increment_atomic<<<(NUM_THREADS + candidate.blockSize - 1) / candidate.blockSize,
+                                                      candidate.blockSize>>>(d_array, NUM_THREADS);
+                                   timer.Stop();
+                                   return (double) timer.Elapsed();
+                                 });
+  const int BLOCK_WIDTH = launch.blockSize;
+  const int BLOCKS = (NUM_THREADS + BLOCK_WIDTH - 1) / BLOCK_WIDTH;
+  printf("%d total threads in %d blocks of %d writing into %d array elements\n",
+         NUM_THREADS, BLOCKS, BLOCK_WIDTH, ARRAY_SIZE);
+
+  // zero out the GPU memory the tuning runs incremented
   cudaMemset((void *) d_array, 0, ARRAY_BYTES); 
 
   // launch the kernel - comment out one of these
-  timer.Start();
-  // increment_naive<<<NUM_THREADS/BLOCK_WIDTH, BLOCK_WIDTH>>>(d_array);
-  increment_atomic<<<NUM_THREADS/BLOCK_WIDTH, BLOCK_WIDTH>>>(d_array);
-  timer.Stop();
-  
+  {
+    TRACE_RANGE("increment_atomic", TRACE_KERNEL);
+    timer.Start();
+    // increment_naive<<<BLOCKS, BLOCK_WIDTH>>>(d_array, NUM_THREADS);
+    increment_atomic<<<BLOCKS, BLOCK_WIDTH>>>(d_array, NUM_THREADS);
+    timer.Stop();
+    TRACE_LAUNCHES(1);
+    // wait for it, so the range covers the kernel
+    timer.Elapsed();
+  }
+
   // copy back the array of sums from GPU and print
-  cudaMemcpy(h_array, d_array, ARRAY_BYTES, cudaMemcpyDeviceToHost);
+  {
+    TRACE_RANGE_BYTES("result", TRACE_TRANSFER, ARRAY_BYTES);
+    cudaMemcpy(h_array, d_array, ARRAY_BYTES, cudaMemcpyDeviceToHost);
+  }
   print_array(h_array, ARRAY_SIZE);
   printf("Time elapsed = %g ms\n", timer.Elapsed());
+
+  // the same launch through the harness, for statistics over many runs
+  {
+    TRACE_RANGE("increment_atomic/benchmark", TRACE_KERNEL);
+    Benchmark("atomics", "increment_atomic").elements(NUM_THREADS).run([&] {
+      cudaMemset((void *) d_array, 0, ARRAY_BYTES);
+      timer.Start();
+      increment_atomic<<<BLOCKS, BLOCK_WIDTH>>>(d_array, NUM_THREADS);
+      timer.Stop();
+      TRACE_LAUNCHES(1);
+      return timer.Elapsed();
+    });
+  }
  
-  // free GPU memory allocation and exit
+  // free GPU memory allocation
   cudaFree(d_array);
+
+  // the same shape as a histogram: NUM_THREADS values counted into numBins bins
+  int numBins = ARRAY_SIZE;
+  if (argc == 2) {
+    numBins = atoi(argv[1]);
+  }
+  if (numBins <= 0) {
+    fprintf(stderr, "error: the number of bins must be positive\n");
+    return 1;
+  }
+  printf("\nhistogram of %d random values into %d bins\n", NUM_THREADS, numBins);
+
+  int * h_values = (int *) malloc(NUM_THREADS * sizeof(int));
+  unsigned int * h_expected = (unsigned int *) calloc(numBins, sizeof(unsigned int));
+  unsigned int * h_bins = (unsigned int *) malloc(numBins * sizeof(unsigned int));
+  for (int i = 0; i < NUM_THREADS; i++) {
+    h_values[i] = random() % numBins;
+    h_expected[h_values[i]]++;
+  }
+
+  int * d_values;
+  unsigned int * d_bins;
+  {
+    TRACE_RANGE_BYTES("cudaMalloc", TRACE_ALLOCATION, NUM_THREADS * sizeof(int) + numBins * sizeof(unsigned int));
+    cudaMalloc((void **) &d_values, NUM_THREADS * sizeof(int));
+    cudaMalloc((void **) &d_bins, numBins * sizeof(unsigned int));
+  }
+  {
+    TRACE_RANGE_BYTES("values", TRACE_TRANSFER, NUM_THREADS * sizeof(int));
+    cudaMemcpy(d_values, h_values, NUM_THREADS * sizeof(int), cudaMemcpyHostToDevice);
+  }
+
+  // time every strategy, whether or not it would be picked for this shape
+  for (int s = GLOBAL_HISTOGRAM; s <= SORT_HISTOGRAM; s++) {
+    HistogramStrategy strategy = (HistogramStrategy) s;
+    if (strategy == SHARED_HISTOGRAM && numBins > SHARED_HISTOGRAM_MAX_BINS) {
+      printf("%-30s skipped, the bins do not fit in shared memory\n", histogram_strategy_name(strategy));
+      continue;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "histogram/%s/bins=%d", histogram_strategy_name(strategy), numBins);
+    BenchmarkResult result;
+    {
+      TRACE_RANGE(histogram_strategy_name(strategy), TRACE_KERNEL);
+      result = Benchmark("atomics", name)
+        .bytes(NUM_THREADS * sizeof(int)).elements(NUM_THREADS)
+        .run([&] {
+          cudaMemset(d_bins, 0, numBins * sizeof(unsigned int));
+          timer.Start();
+          histogram(d_bins, d_values, NUM_THREADS, numBins, strategy);
+          timer.Stop();
+          return timer.Elapsed();
+        });
+    }
+
+    bool correct;
+    {
+      TRACE_RANGE_BYTES("bins", TRACE_TRANSFER, numBins * sizeof(unsigned int));
+      cudaMemcpy(h_bins, d_bins, numBins * sizeof(unsigned int), cudaMemcpyDeviceToHost);
+    }
+    {
+      TRACE_RANGE("check", TRACE_VERIFICATION);
+      correct = memcmp(h_bins, h_expected, numBins * sizeof(unsigned int)) == 0;
+    }
+    printf("%-30s %g ms%s\n", histogram_strategy_name(strategy), result.median, correct ? "" : " (WRONG)");
+  }
+  printf("picked for this shape: %s\n", histogram_strategy_name(choose_histogram_strategy(numBins, NUM_THREADS)));
+
+  // free memory allocations and exit
+  cudaFree(d_values);
+  cudaFree(d_bins);
+  free(h_values);
+  free(h_expected);
+  free(h_bins);
+
+  TRACE_DUMP();
   return 0;
 }
@@ -0,0 +1,54 @@
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <cuda_runtime.h>
+#include "../common/tuning.h"
+
+/*
+ * the CUDA side of the autotuner (see common/tuning.h): the tuning file of a device, and
+ * block size candidates around the one the occupancy calculator suggests for a kernel
+ */
+
+// tells devices apart in the tuning files: the name and the compute capability
+inline std::string device_tuning_name(int device) {
+  cudaDeviceProp props;
+  if (cudaGetDeviceProperties(&props, device) != cudaSuccess) {
+    return "unknown";
+  }
+  char name[300];
+  snprintf(name, sizeof(name), "%s_sm%d%d", props.name, props.major, props.minor);
+  return name;
+}
+
+// the block size with the highest occupancy for "kernel", which needs bytesPerThread of
+// dynamic shared memory per thread of a block
+template <typename Kernel>
+int suggested_block_size(Kernel kernel, size_t bytesPerThread = 0) {
+  int minGridSize = 0, blockSize = 0;
+  cudaOccupancyMaxPotentialBlockSizeVariableSMem(&minGridSize, &blockSize, kernel,
+                                                 [=](int threads) { return threads * bytesPerThread; });
+  return blockSize;
+}
+
+// warp multiples doubling up to the largest block the kernel can run, and the suggested size.
+// "powersOfTwo" rounds the suggestion down to a power of two, for the tree reductions
+template <typename Kernel>
+std::vector<int> block_size_candidates(Kernel kernel, size_t bytesPerThread = 0, bool powersOfTwo = false) {
+  cudaFuncAttributes attributes;
+  int maxSize = cudaFuncGetAttributes(&attributes, kernel) == cudaSuccess ? attributes.maxThreadsPerBlock : 1024;
+
+  int suggested = suggested_block_size(kernel, bytesPerThread);
+  if (powersOfTwo) {
+    int p = 1;
+    while (p * 2 <= suggested) {
+      p *= 2;
+    }
+    suggested = p;
+  }
+  return blockSizeCandidates(suggested, 32, maxSize);
+}
+
+#endif  /* __AUTOTUNE_H__ */
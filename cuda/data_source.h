@@ -0,0 +1,193 @@
+#ifndef __DATA_SOURCE_H__
+#define __DATA_SOURCE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utility>
+#include <cuda_runtime.h>
+#include <cuda_fp16.h>
+#include <curand.h>
+#include "device_pool.h"
+
+/*
+ * where benchmark input comes from. every source ends up in pinned host memory, so the
+ * copies to the device stay asynchronous:
+ *  - HOST_RANDOM_INPUT fills it with random() on the host, one element at a time
+ *  - CURAND_INPUT generates it on the device with cuRAND and copies it down once; the copy on
+ *    the device can be kept, e.g. to check the results against without a pass on the host
+ *  - FILE_INPUT maps a file of raw elements and pins the mapping in place. where the device can
+ *    register read-only memory the pinned pages are those of the page cache, without a copy;
+ *    elsewhere the driver needs writable pages, and the private mapping copies every page
+ * the random sources draw floats from [-1.0f, 1.0f] and integers from [-100, 100].
+ * CURAND_INPUT needs -lcurand.
+ */
+
+enum DataSource {
+  HOST_RANDOM_INPUT,
+  CURAND_INPUT,
+  FILE_INPUT
+};
+
+struct InputSpec {
+  DataSource source;
+  const char * path;            // the file of FILE_INPUT
+  unsigned long long seed;      // the seed of CURAND_INPUT
+};
+
+template <typename T> T random_element() {
+  return (T) (-1.0f + (float)random()/((float)RAND_MAX/2.0f));
+}
+template <> inline long long random_element<long long>() { return random() % 201 - 100; }
+template <> inline __half random_element<__half>() { return __float2half(random_element<float>()); }
+
+// the same ranges from a cuRAND uniform u in (0, 1]
+template <typename T> __device__ T from_uniform(float u) { return (T) (2.0f * u - 1.0f); }
+template <> __device__ inline long long from_uniform<long long>(float u) {
+  long long v = (long long) (u * 201.0f) - 100;
+  return v < 100 ? v : 100;
+}
+template <> __device__ inline __half from_uniform<__half>(float u) { return __float2half(2.0f * u - 1.0f); }
+
+template <typename T>
+__global__ void from_uniform_kernel(T * d_out, const float * d_uniform, size_t count) {
+  for (size_t i = threadIdx.x + (size_t) blockDim.x * blockIdx.x; i < count; i += (size_t) blockDim.x * gridDim.x) {
+    d_out[i] = from_uniform<T>(d_uniform[i]);
+  }
+}
+
+// uniforms are generated this many at a time, so the scratch stays small for any input size
+const size_t CURAND_CHUNK = 1 << 24;
+
+// fills d_out, on the device or in managed memory, with "count" random elements
+template <typename T>
+void generate_random(T * d_out, size_t count, unsigned long long seed) {
+  curandGenerator_t gen;
+  curandCreateGenerator(&gen, CURAND_RNG_PSEUDO_PHILOX4_32_10);
+  curandSetPseudoRandomGeneratorSeed(gen, seed);
+
+  DeviceBuffer<float> uniform(count < CURAND_CHUNK ? count : CURAND_CHUNK);
+  for (size_t offset = 0; offset < count; offset += CURAND_CHUNK) {
+    size_t n = count - offset < CURAND_CHUNK ? count - offset : CURAND_CHUNK;
+    curandGenerateUniform(gen, uniform.get(), n);
+    from_uniform_kernel<<<(unsigned int) ((n + 255) / 256 < 4096 ? (n + 255) / 256 : 4096), 256>>>
+      (d_out + offset, uniform.get(), n);
+  }
+
+  curandDestroyGenerator(gen);
+}
+
+// pinned host input: either allocated, or a file mapping registered with the driver.
+// portable, so every device sees it as pinned
+template <typename T>
+class HostInput {
+public:
+  HostInput() : ptr(NULL), count(0), mappedBytes(0) {}
+  ~HostInput() { release(); }
+
+  // "n" uninitialized elements
+  bool allocate(size_t n) {
+    release();
+    if (cudaHostAlloc((void **) &ptr, n * sizeof(T), cudaHostAllocPortable) != cudaSuccess) {
+      ptr = NULL;
+      return false;
+    }
+    count = n;
+    return true;
+  }
+
+  // the first "maxCount" elements of the file at "path", or all of them if it holds fewer.
+  // the mapping is private, so nothing ever writes back to the file
+  bool map_file(const char * path, size_t maxCount) {
+    release();
+    int device, readOnly = 0;
+    cudaGetDevice(&device);
+    cudaDeviceGetAttribute(&readOnly, cudaDevAttrHostRegisterReadOnlySupported, device);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    size_t n = fstat(fd, &st) == 0 ? st.st_size / sizeof(T) : 0;
+    n = n < maxCount ? n : maxCount;
+    void * mapping = n > 0 ? mmap(NULL, n * sizeof(T), readOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      return false;
+    }
+
+    // pinning faults in every page once, which reads the file at sequential disk speed
+    unsigned int flags = cudaHostRegisterPortable | (readOnly ? cudaHostRegisterReadOnly : 0);
+    if (cudaHostRegister(mapping, n * sizeof(T), flags) != cudaSuccess) {
+      munmap(mapping, n * sizeof(T));
+      return false;
+    }
+    ptr = (T *) mapping;
+    count = n;
+    mappedBytes = n * sizeof(T);
+    return true;
+  }
+
+  T * get() const { return ptr; }
+  size_t size() const { return count; }
+
+private:
+  HostInput(const HostInput &);
+  HostInput & operator=(const HostInput &);
+
+  void release() {
+    if (ptr && mappedBytes) {
+      cudaHostUnregister(ptr);
+      munmap(ptr, mappedBytes);
+    } else if (ptr) {
+      cudaFreeHost(ptr);
+    }
+    ptr = NULL;
+    count = 0;
+    mappedBytes = 0;
+  }
+
+  T * ptr;
+  size_t count;
+  size_t mappedBytes;
+};
+
+// opens "count" elements of input from the chosen source; a file may hold fewer, check size().
+// with "generated", input made on the device stays there too; it is left empty otherwise
+template <typename T>
+bool open_input(HostInput<T> &input, const InputSpec &spec, size_t count, DeviceBuffer<T> * generated = NULL) {
+  switch (spec.source) {
+  case FILE_INPUT:
+    return input.map_file(spec.path, count);
+
+  case CURAND_INPUT: {
+    if (!input.allocate(count)) {
+      return false;
+    }
+    DeviceBuffer<T> onDevice(count);
+    generate_random(onDevice.get(), count, spec.seed);
+    cudaMemcpy(input.get(), onDevice.get(), count * sizeof(T), cudaMemcpyDeviceToHost);
+    if (generated) {
+      *generated = std::move(onDevice);
+    }
+    return true;
+  }
+
+  default:
+    if (!input.allocate(count)) {
+      return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+      input.get()[i] = random_element<T>();
+    }
+    return true;
+  }
+}
+
+#endif  /* __DATA_SOURCE_H__ */
@@ -0,0 +1,204 @@
+#ifndef __DEVICE_POOL_H__
+#define __DEVICE_POOL_H__
+
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <cuda_runtime.h>
+#include "../common/trace.h"
+
+/*
+ * caching device allocator: freed blocks are kept in per-device lists of power-of-two size
+ * classes and handed out again instead of going back to cudaFree, so code that allocates the
+ * same buffers over and over only pays for cudaMalloc the first time.
+ * a block released on a stream is tagged with that stream and an event recorded there. an
+ * allocation for the same stream gets it back right away, since the stream runs the new
+ * owner's work after the old owner's; any other stream only once the event has completed, so
+ * pending work on the old owner's stream is never clobbered. a block drawn for a stream is
+ * therefore only safe to use on that stream, or after synchronizing with it.
+ * the pool is never torn down: at exit the CUDA runtime may already be gone, and it frees
+ * the device memory itself.
+ */
+
+const size_t DEVICE_POOL_MIN_BLOCK = 256;
+
+class DevicePool {
+public:
+  // the pool shared by everything in the process
+  static DevicePool & instance() {
+    static DevicePool pool;
+    return pool;
+  }
+
+  // a block of at least "bytes" bytes on the current device, to be used on "stream"
+  void * allocate(size_t bytes, cudaStream_t stream = 0) {
+    int device;
+    cudaGetDevice(&device);
+    size_t blockSize = size_class(bytes);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<Block> &free = cached[Key(device, blockSize)];
+      size_t reuse = free.size();
+      for (size_t i = 0; i < free.size() && reuse == free.size(); i++) {
+        if (free[i].stream == stream) {
+          reuse = i;
+        }
+      }
+      for (size_t i = 0; i < free.size() && reuse == free.size(); i++) {
+        if (cudaEventQuery(free[i].ready) == cudaSuccess) {
+          reuse = i;
+        }
+      }
+      if (reuse < free.size()) {
+        Block block = free[reuse];
+        free.erase(free.begin() + reuse);
+        cudaEventDestroy(block.ready);
+        live[block.ptr] = Key(device, blockSize);
+        return block.ptr;
+      }
+    }
+
+    // nothing to reuse; when the device is full, give the cached blocks back and retry once
+    TRACE_RANGE_BYTES("cudaMalloc", TRACE_ALLOCATION, blockSize);
+    void * ptr = NULL;
+    if (cudaMalloc(&ptr, blockSize) != cudaSuccess) {
+      cudaGetLastError();
+      trim();
+      if (cudaMalloc(&ptr, blockSize) != cudaSuccess) {
+        return NULL;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    live[ptr] = Key(device, blockSize);
+    return ptr;
+  }
+
+  // gives a block back to the pool once the work already queued on "stream" is done with it
+  void release(void * ptr, cudaStream_t stream = 0) {
+    if (!ptr) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<void *, Key>::iterator it = live.find(ptr);
+    if (it == live.end()) {
+      return;
+    }
+
+    // the event belongs to the block's device, which need not be the current one
+    int current;
+    cudaGetDevice(&current);
+    cudaSetDevice(it->second.first);
+    Block block = { ptr, NULL, stream };
+    cudaEventCreateWithFlags(&block.ready, cudaEventDisableTiming);
+    cudaEventRecord(block.ready, stream);
+    cudaSetDevice(current);
+
+    cached[it->second].push_back(block);
+    live.erase(it);
+  }
+
+  // frees every cached block; blocks still handed out are not affected
+  void trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    int current;
+    cudaGetDevice(&current);
+    for (std::map<Key, std::vector<Block> >::iterator it = cached.begin(); it != cached.end(); ++it) {
+      cudaSetDevice(it->first.first);
+      for (size_t i = 0; i < it->second.size(); i++) {
+        cudaEventSynchronize(it->second[i].ready);
+        cudaEventDestroy(it->second[i].ready);
+        cudaFree(it->second[i].ptr);
+      }
+    }
+    cached.clear();
+    cudaSetDevice(current);
+  }
+
+private:
+  typedef std::pair<int, size_t> Key;    // device, size class
+
+  struct Block {
+    void * ptr;
+    cudaEvent_t ready;
+    cudaStream_t stream;                 // The stream it was released on.
+  };
+
+  DevicePool() {}
+  DevicePool(const DevicePool &);
+  DevicePool & operator=(const DevicePool &);
+
+  // the smallest power of two that holds "bytes", and at least DEVICE_POOL_MIN_BLOCK
+  static size_t size_class(size_t bytes) {
+    size_t size = DEVICE_POOL_MIN_BLOCK;
+    while (size < bytes) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  std::mutex mutex;
+  std::map<Key, std::vector<Block> > cached;
+  std::map<void *, Key> live;
+};
+
+// "count" elements of T drawn from the pool on the current device, released when the handle
+// goes out of scope. give it the stream the buffer is used on, so a block that stream just
+// released can be reused at once, and the release waits for the work queued there
+template <typename T>
+class DeviceBuffer {
+public:
+  DeviceBuffer(size_t count = 0, DevicePool &pool = DevicePool::instance())
+    : pool(&pool), ptr(NULL), count(0), stream(0) {
+    reset(count);
+  }
+
+  DeviceBuffer(size_t count, cudaStream_t stream, DevicePool &pool = DevicePool::instance())
+    : pool(&pool), ptr(NULL), count(0), stream(stream) {
+    reset(count);
+  }
+
+  ~DeviceBuffer() { reset(0); }
+
+  DeviceBuffer(DeviceBuffer &&other) : pool(other.pool), ptr(other.ptr), count(other.count), stream(other.stream) {
+    other.ptr = NULL;
+    other.count = 0;
+  }
+
+  DeviceBuffer & operator=(DeviceBuffer &&other) {
+    std::swap(pool, other.pool);
+    std::swap(ptr, other.ptr);
+    std::swap(count, other.count);
+    std::swap(stream, other.stream);
+    return *this;
+  }
+
+  // drops the current block and draws a new one for "count" elements
+  void reset(size_t n) {
+    pool->release(ptr, stream);
+    ptr = n > 0 ? (T *) pool->allocate(n * sizeof(T), stream) : NULL;
+    count = ptr ? n : 0;
+  }
+
+  void set_stream(cudaStream_t s) { stream = s; }
+
+  T * get() const { return ptr; }
+  size_t size() const { return count; }
+  size_t bytes() const { return count * sizeof(T); }
+
+private:
+  DeviceBuffer(const DeviceBuffer &);
+  DeviceBuffer & operator=(const DeviceBuffer &);
+
+  DevicePool * pool;
+  T * ptr;
+  size_t count;
+  cudaStream_t stream;
+};
+
+#endif  /* __DEVICE_POOL_H__ */
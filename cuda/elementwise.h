@@ -0,0 +1,60 @@
+#ifndef __ELEMENTWISE_H__
+#define __ELEMENTWISE_H__
+
+#include <cuda_runtime.h>
+#include "../common/tuning.h"
+
+/*
+ * elementwise kernels: any number of elements, loaded and stored as float4 through a
+ * grid-stride loop, with the last size % 4 elements handled one by one. the pointers must
+ * be 16-byte aligned, which everything cudaMalloc returns is. the launch shape can be tuned
+ * (see autotune.h): threads per block, and float4s per thread before the loop wraps.
+ */
+
+struct SquareOp {
+  __host__ __device__ float operator()(float x) const { return x * x; }
+};
+
+template <typename Op>
+__global__ void transform_kernel(float * d_out, const float * d_in, int size, Op op) {
+  int myId = threadIdx.x + blockDim.x * blockIdx.x;
+  int vecs = size / 4;
+
+  const float4 * in4 = reinterpret_cast<const float4 *>(d_in);
+  float4 * out4 = reinterpret_cast<float4 *>(d_out);
+  for (int i = myId; i < vecs; i += blockDim.x * gridDim.x) {
+    float4 v = in4[i];
+    out4[i] = make_float4(op(v.x), op(v.y), op(v.z), op(v.w));
+  }
+
+  int tail = vecs * 4 + myId;
+  if (tail < size) {
+    d_out[tail] = op(d_in[tail]);
+  }
+}
+
+const int ELEMENTWISE_THREADS = 256;
+const int ELEMENTWISE_MAX_BLOCKS = 4096;
+
+inline LaunchConfig default_elementwise_launch() {
+  LaunchConfig launch = { ELEMENTWISE_THREADS, 1 };
+  return launch;
+}
+
+// launch.itemsPerThread float4s per thread up to ELEMENTWISE_MAX_BLOCKS blocks, beyond that
+// the threads loop further
+inline int elementwise_blocks(int size, const LaunchConfig &launch = default_elementwise_launch()) {
+  int perBlock = launch.blockSize * launch.itemsPerThread;
+  int blocks = (size / 4 + perBlock - 1) / perBlock;
+  blocks = blocks < ELEMENTWISE_MAX_BLOCKS ? blocks : ELEMENTWISE_MAX_BLOCKS;
+  return blocks > 0 ? blocks : 1;
+}
+
+// d_out[i] = op(d_in[i]) for every i < size
+template <typename Op>
+void transform(float * d_out, const float * d_in, int size, Op op, cudaStream_t stream = 0,
+               const LaunchConfig &launch = default_elementwise_launch()) {
+  transform_kernel<<<elementwise_blocks(size, launch), launch.blockSize, 0, stream>>>(d_out, d_in, size, op);
+}
+
+#endif  /* __ELEMENTWISE_H__ */
@@ -0,0 +1,176 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stddef.h>
+#include <new>
+#include <cuda_runtime.h>
+#include <thrust/binary_search.h>
+#include <thrust/copy.h>
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/iterator/counting_iterator.h>
+#include <thrust/sort.h>
+#include <thrust/system/cuda/execution_policy.h>
+#include <thrust/transform.h>
+#include "device_pool.h"
+
+/*
+ * histogram engine: counts how many of the "size" values in d_in fall into each of numBins
+ * bins, d_bins[v] being the count of value v. values outside [0, numBins) are ignored.
+ * the atomic strategies add to d_bins, so it must be zeroed first.
+ */
+
+enum HistogramStrategy {
+  GLOBAL_HISTOGRAM,           // one global atomicAdd per value, the increment_atomic pattern
+  SHARED_HISTOGRAM,           // per-block __shared__ sub-histograms, merged at the end
+  WARP_AGGREGATED_HISTOGRAM,  // lanes with the same bin elect one lane to add for all of them
+  SORT_HISTOGRAM              // sort the values, then count the runs; no atomics at all
+};
+
+const int HISTOGRAM_BLOCKS = 256;
+const int HISTOGRAM_THREADS = 256;
+
+// bins a block can privatize; kept at a quarter of the usual 48KB so several blocks fit per SM
+const int SHARED_HISTOGRAM_MAX_BINS = 12 * 1024 / sizeof(unsigned int);
+
+// above this many bins the counters no longer stay in L2, and sorting beats scattered atomics
+const int SORT_HISTOGRAM_MIN_BINS = 1 << 22;
+
+__global__ void global_histogram_kernel(unsigned int * d_bins, const int * d_in, int size, int numBins) {
+  for (int i = threadIdx.x + blockDim.x * blockIdx.x; i < size; i += blockDim.x * gridDim.x) {
+    int bin = d_in[i];
+    if (bin >= 0 && bin < numBins) {
+      atomicAdd(&d_bins[bin], 1);
+    }
+  }
+}
+
+// the atomics of a block only contend in its own shared memory copy of the bins, and each
+// bin costs a single global atomic per block when the copies are merged
+__global__ void shared_histogram_kernel(unsigned int * d_bins, const int * d_in, int size, int numBins) {
+  extern __shared__ unsigned int s_bins[];
+
+  for (int b = threadIdx.x; b < numBins; b += blockDim.x) {
+    s_bins[b] = 0;
+  }
+  __syncthreads();
+
+  for (int i = threadIdx.x + blockDim.x * blockIdx.x; i < size; i += blockDim.x * gridDim.x) {
+    int bin = d_in[i];
+    if (bin >= 0 && bin < numBins) {
+      atomicAdd(&s_bins[bin], 1);
+    }
+  }
+  __syncthreads();
+
+  for (int b = threadIdx.x; b < numBins; b += blockDim.x) {
+    if (s_bins[b] > 0) {
+      atomicAdd(&d_bins[b], s_bins[b]);
+    }
+  }
+}
+
+// __match_any_sync groups the lanes of a warp that hit the same bin; the lowest lane of each
+// group adds the group size, so a warp issues one atomic per distinct bin instead of 32.
+// needs compute capability 7.0
+__global__ void warp_aggregated_histogram_kernel(unsigned int * d_bins, const int * d_in, int size, int numBins) {
+  int lane = threadIdx.x % warpSize;
+
+  // every lane runs the same number of iterations, so the whole warp reaches the ballot
+  // together; the lanes past the end of the input sit out the match. in 64 bits, since the
+  // rounded-up end and the last step can pass INT_MAX
+  long long stride = (long long) blockDim.x * gridDim.x;
+  long long end = (size + stride - 1) / stride * stride;
+  for (long long i = threadIdx.x + (long long) blockDim.x * blockIdx.x; i < end; i += stride) {
+    unsigned int mask = __ballot_sync(0xffffffff, i < size);
+    if (i < size) {
+      int bin = d_in[i];
+      unsigned int peers = __match_any_sync(mask, bin);
+      int leader = __ffs(peers) - 1;
+      if (lane == leader && bin >= 0 && bin < numBins) {
+        atomicAdd(&d_bins[bin], __popc(peers));
+      }
+    }
+  }
+}
+
+// thrust's temporary storage, e.g. the sort's, drawn from the pool instead of cudaMalloc
+struct PoolAllocator {
+  typedef char value_type;
+
+  char * allocate(std::ptrdiff_t bytes) {
+    char * ptr = (char *) DevicePool::instance().allocate(bytes);
+    if (!ptr) {
+      throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  void deallocate(char * ptr, size_t) { DevicePool::instance().release(ptr); }
+};
+
+// sorts a copy of the input; then the count of bin b is the distance between the ends of the
+// runs of b - 1 and b, found by a vectorized upper_bound over the values -1 .. numBins - 1.
+// the scratch buffers and thrust's temporaries come from the pool, so repeated calls do not
+// allocate
+inline void sort_histogram(unsigned int * d_bins, const int * d_in, int size, int numBins) {
+  DeviceBuffer<int> sorted(size);
+  DeviceBuffer<unsigned int> ends(numBins + 1);
+  int * d_sorted = sorted.get();
+  unsigned int * d_ends = ends.get();
+
+  PoolAllocator alloc;
+  thrust::copy(thrust::cuda::par(alloc), d_in, d_in + size, d_sorted);
+  thrust::sort(thrust::cuda::par(alloc), d_sorted, d_sorted + size);
+  thrust::upper_bound(thrust::cuda::par(alloc), d_sorted, d_sorted + size,
+                      thrust::counting_iterator<int>(-1), thrust::counting_iterator<int>(numBins), d_ends);
+  thrust::transform(thrust::cuda::par(alloc), d_ends + 1, d_ends + numBins + 1, d_ends, d_bins,
+                    thrust::minus<unsigned int>());
+}
+
+// privatization pays off once every block sees more values than it has bins to clear and
+// merge; huge bin counts go to the sort, everything else gets the warp-aggregated atomics
+inline HistogramStrategy choose_histogram_strategy(int numBins, int size) {
+  if (numBins <= SHARED_HISTOGRAM_MAX_BINS && size / HISTOGRAM_BLOCKS >= numBins) {
+    return SHARED_HISTOGRAM;
+  }
+  if (numBins >= SORT_HISTOGRAM_MIN_BINS) {
+    return SORT_HISTOGRAM;
+  }
+  return WARP_AGGREGATED_HISTOGRAM;
+}
+
+inline const char * histogram_strategy_name(HistogramStrategy strategy) {
+  switch (strategy) {
+  case GLOBAL_HISTOGRAM:          return "global atomics";
+  case SHARED_HISTOGRAM:          return "shared memory sub-histograms";
+  case WARP_AGGREGATED_HISTOGRAM: return "warp-aggregated atomics";
+  case SORT_HISTOGRAM:            return "sort then count";
+  }
+  return "unknown";
+}
+
+inline void histogram(unsigned int * d_bins, const int * d_in, int size, int numBins, HistogramStrategy strategy) {
+  switch (strategy) {
+  case GLOBAL_HISTOGRAM:
+    global_histogram_kernel<<<HISTOGRAM_BLOCKS, HISTOGRAM_THREADS>>>(d_bins, d_in, size, numBins);
+    break;
+  case SHARED_HISTOGRAM:
+    shared_histogram_kernel<<<HISTOGRAM_BLOCKS, HISTOGRAM_THREADS, numBins * sizeof(unsigned int)>>>
+      (d_bins, d_in, size, numBins);
+    break;
+  case WARP_AGGREGATED_HISTOGRAM:
+    warp_aggregated_histogram_kernel<<<HISTOGRAM_BLOCKS, HISTOGRAM_THREADS>>>(d_bins, d_in, size, numBins);
+    break;
+  case SORT_HISTOGRAM:
+    sort_histogram(d_bins, d_in, size, numBins);
+    break;
+  }
+}
+
+// picks the strategy from the bin count and the input size
+inline void histogram(unsigned int * d_bins, const int * d_in, int size, int numBins) {
+  histogram(d_bins, d_in, size, numBins, choose_histogram_strategy(numBins, size));
+}
+
+#endif  /* __HISTOGRAM_H__ */
@@ -0,0 +1,62 @@
+#ifndef __MANAGED_H__
+#define __MANAGED_H__
+
+#include <stddef.h>
+#include <cuda_runtime.h>
+
+/*
+ * managed memory: one pointer valid on the host and on every device, whose pages migrate to
+ * wherever they are touched. migrating them ahead of time with prefetch() keeps the kernels
+ * free of page faults; without it only the pages a kernel actually touches move, which can
+ * beat an explicit copy of the whole buffer when little of it is read.
+ * prefetching and advice need a device with concurrent managed access (compute 6.0, not
+ * windows); elsewhere they do nothing and the whole buffer migrates at every launch.
+ */
+
+inline bool managed_hints_supported(int device) {
+  int supported = 0;
+  cudaDeviceGetAttribute(&supported, cudaDevAttrConcurrentManagedAccess, device);
+  return supported != 0;
+}
+
+template <typename T>
+class ManagedBuffer {
+public:
+  ManagedBuffer(size_t count) : ptr(NULL), count(count) {
+    cudaMallocManaged((void **) &ptr, count * sizeof(T));
+  }
+
+  ~ManagedBuffer() { cudaFree(ptr); }
+
+  // the buffer is mostly read: every device that reads it keeps its own copy of the pages,
+  // instead of moving them back and forth. a write drops all other copies
+  void advise_read_mostly() {
+    int device;
+    cudaGetDevice(&device);
+    if (managed_hints_supported(device)) {
+      cudaMemAdvise(ptr, bytes(), cudaMemAdviseSetReadMostly, device);
+    }
+  }
+
+  // migrates the whole buffer to "device", or to the host with cudaCpuDeviceId
+  void prefetch(int device, cudaStream_t stream = 0) {
+    int current;
+    cudaGetDevice(&current);
+    if (managed_hints_supported(current)) {
+      cudaMemPrefetchAsync(ptr, bytes(), device, stream);
+    }
+  }
+
+  T * get() const { return ptr; }
+  size_t size() const { return count; }
+  size_t bytes() const { return count * sizeof(T); }
+
+private:
+  ManagedBuffer(const ManagedBuffer &);
+  ManagedBuffer & operator=(const ManagedBuffer &);
+
+  T * ptr;
+  size_t count;
+};
+
+#endif  /* __MANAGED_H__ */
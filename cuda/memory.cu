@@ -1,5 +1,12 @@
 // Using different memory spaces in CUDA
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../common/benchmark.h"
+#include "gputimer.h"
+#include "managed.h"
+#include "scan.h"
 
 /**********************
  * using local memory *
@@ -20,74 +27,202 @@ __global__ void use_local_memory_GPU(float in) {
  **********************/
 
 // a __global__ function runs on the GPU & can be called from host
-__global__ void use_global_memory_GPU(float *array) {
+__global__ void use_global_memory_GPU(float *array, int size) {
   // "array" is a pointer into global memory on the device
-  array[threadIdx.x] = 2.0f * (float) threadIdx.x;
+  int index = threadIdx.x + blockDim.x * blockIdx.x;
+  if (index < size) { array[index] = 2.0f * (float) index; }
 }
 
 /**********************
  * using shared memory *
  **********************/
 
-// (for clarity, hardcoding 128 threads/elements and omitting out-of-bounds checks)
-__global__ void use_shared_memory_GPU(float *array) {
-  // local variables, private to each thread
-  int i, index = threadIdx.x;
-  float average, sum = 0.0f;
-
-  // __shared__ variables are visible to all threads in the thread block
-  // and have the same lifetime as the thread block
-  __shared__ float sh_arr[128];
-
-  // copy data from "array" in global memory to sh_arr in shared memory.
-  // here, each thread is responsible for copying a single element.
-  sh_arr[index] = array[index];
+// if array[index] is greater than the average of array[0..index-1], replace with average
+// (the sum of the elements before it, divided by index + 1). rather than every thread
+// summing its own prefix in a serial loop, which is O(n^2) work over the array, the prefix
+// sums come from one exclusive scan (see scan.h): each of its tiles is scanned in a tree in
+// __shared__ memory, and the tiles pass their totals along in global memory. the clamp is
+// then O(1) per element, so any size runs on as many blocks as it needs.
+// since array[] is in global memory, this change will be seen by the host
+__global__ void clamp_to_average_GPU(float *array, const float *prefix, int size) {
+  int index = threadIdx.x + blockDim.x * blockIdx.x;
+  if (index < size) {
+    float average = prefix[index] / (index + 1.0f);
+    if (array[index] > average) { array[index] = average; }
+  }
+}
 
-  __syncthreads();    // ensure all the writes to shared memory have completed
+// clamps the "size" elements at d_array in place
+void clamp_to_average(float *d_array, int size) {
+  DeviceBuffer<float> prefix(size);
+  exclusive_scan(prefix.get(), d_array, size, LOOKBACK_SCAN, SumOp<float>());
+  clamp_to_average_GPU<<<(size + 255) / 256, 256>>>(d_array, prefix.get(), size);
+}
 
-  // now, sh_arr is fully populated. Let's find the average of all previous elements
-  for (i=0; i<index; i++) { sum += sh_arr[i]; }
-  average = sum / (index + 1.0f);
+// the same clamp on the host, sequentially, to check the device against
+void host_clamp_to_average(float *array, int size) {
+  double sum = 0.0;
+  for (int i = 0; i < size; i++) {
+    float average = (float) (sum / (i + 1.0));
+    sum += array[i];
+    if (array[i] > average) { array[i] = average; }
+  }
+}
 
-  // if array[index] is greater than the average of array[0..index-1], replace with average.
-  // since array[] is in global memory, this change will be seen by the host (and potentially 
-  // other thread blocks, if any)
-  if (array[index] > average) { array[index] = average; }
+// compares the result of both kernels with the host; the device sums in a different order,
+// so the prefixes only agree up to rounding
+bool check_result(const float *result, int size) {
+  float *expected = (float *) malloc(sizeof(float) * size);
+  for (int i = 0; i < size; i++) { expected[i] = 2.0f * (float) i; }
+  host_clamp_to_average(expected, size);
+
+  bool ok = true;
+  for (int i = 0; i < size && ok; i++) {
+    float tolerance = 1e-3f * fmaxf(1.0f, fabsf(expected[i]));
+    if (fabsf(result[i] - expected[i]) > tolerance) {
+      printf("mismatch at %d: %f, expected %f\n", i, result[i], expected[i]);
+      ok = false;
+    }
+  }
+  free(expected);
+  return ok;
+}
 
-  // the following code has NO EFFECT: it modifies shared memory, but 
-  // the resulting modified data is never copied back to global memory
-  // and vanishes when the thread block completes
-  sh_arr[index] = 3.14;
+// the same two kernels on managed memory: there are no copies, the pages of "arr" follow the
+// accesses. prefetching moves them before each launch, so the kernels run without page faults
+// and the migration is timed on its own
+void run_managed(int size) {
+  int dev;
+  cudaGetDevice(&dev);
+  if (!managed_hints_supported(dev)) {
+    printf("no concurrent managed access: pages migrate on demand, migration counts as kernel time\n");
+  }
+
+  ManagedBuffer<float> arr(size);
+  GpuTimer toDevice, kernels, toHost;
+
+  // "arr" is both read and written by the kernels, so it gets no read-mostly advice
+  toDevice.Start();
+  arr.prefetch(dev);
+  toDevice.Stop();
+
+  kernels.Start();
+  use_global_memory_GPU<<<(size + 255) / 256, 256>>>(arr.get(), size);
+  clamp_to_average(arr.get(), size);
+  kernels.Stop();
+
+  // bring the result back before the host reads it
+  toHost.Start();
+  arr.prefetch(cudaCpuDeviceId);
+  toHost.Stop();
+  cudaDeviceSynchronize();
+
+  printf("managed arr[%d] = %f\n", size - 1, arr.get()[size - 1]);
+  printf("migration: %f ms to the device, %f ms back; kernels: %f ms\n",
+         toDevice.Elapsed(), toHost.Elapsed(), kernels.Elapsed());
+  if (!check_result(arr.get(), size)) {
+    printf("managed result is wrong\n");
+  }
+
+  // the round trip again through the harness: migration there and back, and the kernels
+  Benchmark("memory", "managed/migration").bytes(2.0 * arr.bytes()).run([&] {
+    toDevice.Start();
+    arr.prefetch(dev);
+    arr.prefetch(cudaCpuDeviceId);
+    toDevice.Stop();
+    return toDevice.Elapsed();
+  });
+  arr.prefetch(dev);
+  Benchmark("memory", "managed/kernels").elements(size).run([&] {
+    kernels.Start();
+    use_global_memory_GPU<<<(size + 255) / 256, 256>>>(arr.get(), size);
+    clamp_to_average(arr.get(), size);
+    kernels.Stop();
+    return kernels.Elapsed();
+  });
 }
 
 int main(int argc, char **argv) {
+  // usage: memory [explicit|managed] [size]. "managed" runs the global and shared memory
+  // kernels on managed memory instead; the arrays hold 128 elements unless told otherwise
+  int size = argc >= 3 ? atoi(argv[2]) : 128;
+  if (size <= 0) {
+    printf("size must be positive\n");
+    return 1;
+  }
+  if (argc >= 2 && strcmp(argv[1], "managed") == 0) {
+    run_managed(size);
+    return 0;
+  }
+
+  GpuTimer copies, kernels;
+
   // first, call a kernel that shows using local memory 
   use_local_memory_GPU<<<1, 128>>>(2.0f);
 
   // next, call a kernel that shows using global memory
-  float h_arr[128];   // convention: h_ variables live on host
+  float *h_arr = (float *) malloc(sizeof(float) * size);   // convention: h_ variables live on host
   float *d_arr;       // convention: d_ variables live on device (GPU global mem)
 
   // allocate global memory on the device, place result in "d_arr"
-  cudaMalloc((void **) &d_arr, sizeof(float) * 128);
+  cudaMalloc((void **) &d_arr, sizeof(float) * size);
   
   // now copy data from host memory "h_arr" to device memory "d_arr"
-  cudaMemcpy((void *)d_arr, (void *)h_arr, sizeof(float) * 128, cudaMemcpyHostToDevice);
+  copies.Start();
+  cudaMemcpy((void *)d_arr, (void *)h_arr, sizeof(float) * size, cudaMemcpyHostToDevice);
+  copies.Stop();
+  float copyTime = copies.Elapsed();
   
-  // launch the kernel (1 block of 128 threads)
-  use_global_memory_GPU<<<1, 128>>>(d_arr);  // modifies the contents of array at d_arr
+  // launch the kernel (blocks of 256 threads, as many as cover the array)
+  kernels.Start();
+  use_global_memory_GPU<<<(size + 255) / 256, 256>>>(d_arr, size);  // modifies the contents of array at d_arr
+  kernels.Stop();
+  float kernelTime = kernels.Elapsed();
   
   // copy the modified array back to the host, overwriting contents of h_arr
-  cudaMemcpy((void *)h_arr, (void *)d_arr, sizeof(float) * 128, cudaMemcpyDeviceToHost);
+  copies.Start();
+  cudaMemcpy((void *)h_arr, (void *)d_arr, sizeof(float) * size, cudaMemcpyDeviceToHost);
+  copies.Stop();
+  copyTime += copies.Elapsed();
   // ... do other stuff ...
 
-  // next, call a kernel that shows using shared memory
+  // next, call the operator that shows using shared memory
   // as before, pass in a pointer to data in global memory
-  use_shared_memory_GPU<<<1, 128>>>(d_arr); 
+  kernels.Start();
+  clamp_to_average(d_arr, size);
+  kernels.Stop();
+  kernelTime += kernels.Elapsed();
   
   // copy the modified array back to the host
-  cudaMemcpy((void *)h_arr, (void *)d_arr, sizeof(float) * 128, cudaMemcpyHostToDevice);
+  copies.Start();
+  cudaMemcpy((void *)h_arr, (void *)d_arr, sizeof(float) * size, cudaMemcpyDeviceToHost);
+  copies.Stop();
+  copyTime += copies.Elapsed();
+
+  printf("explicit arr[%d] = %f\n", size - 1, h_arr[size - 1]);
+  printf("copies: %f ms; kernels: %f ms\n", copyTime, kernelTime);
+  if (!check_result(h_arr, size)) {
+    printf("explicit result is wrong\n");
+  }
+
+  // the same copies and kernels through the harness
+  Benchmark("memory", "explicit/copies").bytes(2.0 * sizeof(float) * size).run([&] {
+    copies.Start();
+    cudaMemcpy((void *)d_arr, (void *)h_arr, sizeof(float) * size, cudaMemcpyHostToDevice);
+    cudaMemcpy((void *)h_arr, (void *)d_arr, sizeof(float) * size, cudaMemcpyDeviceToHost);
+    copies.Stop();
+    return copies.Elapsed();
+  });
+  Benchmark("memory", "explicit/kernels").elements(size).run([&] {
+    kernels.Start();
+    use_global_memory_GPU<<<(size + 255) / 256, 256>>>(d_arr, size);
+    clamp_to_average(d_arr, size);
+    kernels.Stop();
+    return kernels.Elapsed();
+  });
   
   // ... do other stuff ...
+  cudaFree(d_arr);
+  free(h_arr);
   return 0;
 }
@@ -0,0 +1,173 @@
+#ifndef __OPERATORS_H__
+#define __OPERATORS_H__
+
+#include <float.h>
+#include <limits.h>
+#include <type_traits>
+
+/*
+ * associative operators for the reduction and scan kernels. an operator defines
+ *
+ *   value_type         the type it combines; partials are stored as value_type
+ *   identity()         the value e with op(e, x) == x, used to pad the tail of a block
+ *   lift(x, i)         turns the input element x found at index i into a value_type
+ *   operator()(a, b)   combines two values, and must be associative
+ *
+ * any functor with these members can be passed to reduce() or scan() as a custom operator.
+ * wrapping one with transform_op() fuses an elementwise transform into the loads.
+ */
+
+// the largest and smallest value of each element type, the identities of min and max
+template <typename T> struct Limits;
+
+template <> struct Limits<float> {
+  __host__ __device__ static float lowest() { return -FLT_MAX; }
+  __host__ __device__ static float max()    { return  FLT_MAX; }
+};
+
+template <> struct Limits<double> {
+  __host__ __device__ static double lowest() { return -DBL_MAX; }
+  __host__ __device__ static double max()    { return  DBL_MAX; }
+};
+
+template <> struct Limits<int> {
+  __host__ __device__ static int lowest() { return INT_MIN; }
+  __host__ __device__ static int max()    { return INT_MAX; }
+};
+
+template <> struct Limits<long long> {
+  __host__ __device__ static long long lowest() { return LLONG_MIN; }
+  __host__ __device__ static long long max()    { return LLONG_MAX; }
+};
+
+template <typename T>
+struct SumOp {
+  typedef T value_type;
+
+  __host__ __device__ T identity() const { return T(0); }
+
+  // converts narrower inputs, so that e.g. __half data is summed in float
+  template <typename In>
+  __host__ __device__ T lift(const In &x, int) const { return static_cast<T>(x); }
+
+  __host__ __device__ T operator()(const T &a, const T &b) const { return a + b; }
+};
+
+template <typename T>
+struct MinOp {
+  typedef T value_type;
+
+  __host__ __device__ T identity() const { return Limits<T>::max(); }
+
+  template <typename In>
+  __host__ __device__ T lift(const In &x, int) const { return static_cast<T>(x); }
+
+  __host__ __device__ T operator()(const T &a, const T &b) const { return b < a ? b : a; }
+};
+
+template <typename T>
+struct MaxOp {
+  typedef T value_type;
+
+  __host__ __device__ T identity() const { return Limits<T>::lowest(); }
+
+  template <typename In>
+  __host__ __device__ T lift(const In &x, int) const { return static_cast<T>(x); }
+
+  __host__ __device__ T operator()(const T &a, const T &b) const { return a < b ? b : a; }
+};
+
+// a value together with the index it was found at
+template <typename T>
+struct IndexedValue {
+  T value;
+  int index;
+};
+
+// finds the largest element and its index; ties go to the lowest index, so the
+// result does not depend on the order the blocks combine in
+template <typename T>
+struct ArgMaxOp {
+  typedef IndexedValue<T> value_type;
+
+  __host__ __device__ value_type identity() const {
+    value_type v = { Limits<T>::lowest(), INT_MAX };
+    return v;
+  }
+
+  __host__ __device__ value_type lift(const T &x, int i) const {
+    value_type v = { x, i };
+    return v;
+  }
+
+  // partials of later passes already carry their index
+  __host__ __device__ value_type lift(const value_type &x, int) const { return x; }
+
+  __host__ __device__ value_type operator()(const value_type &a, const value_type &b) const {
+    if (b.value > a.value || (b.value == a.value && b.index < a.index)) {
+      return b;
+    }
+    return a;
+  }
+};
+
+// an operator over f(x) instead of x: the transform runs as each input element is lifted, so
+// a reduction or scan of the transformed input takes a single pass over memory, with no
+// temporary array in between. f is called as f(x, i), with the index in the whole input, or
+// as f(x) when it takes no index, like the functors of elementwise.h. partials are never
+// transformed again: the drivers combine them with partial_op(). to chain transforms,
+// compose them into one functor rather than nesting TransformOps
+template <typename Op, typename F>
+struct TransformOp {
+  typedef typename Op::value_type value_type;
+
+  Op op;
+  F f;
+
+  __host__ __device__ value_type identity() const { return op.identity(); }
+
+  template <typename In>
+  __host__ __device__ value_type lift(const In &x, int i) const { return op.lift(apply(f, x, i, 0), i); }
+
+  __host__ __device__ value_type operator()(const value_type &a, const value_type &b) const { return op(a, b); }
+
+private:
+  // the int/long argument prefers f(x, i) when both calls compile
+  template <typename G, typename X>
+  __host__ __device__ static auto apply(const G &g, const X &x, int i, int) -> decltype(g(x, i)) { return g(x, i); }
+  template <typename G, typename X>
+  __host__ __device__ static auto apply(const G &g, const X &x, int, long) -> decltype(g(x)) { return g(x); }
+};
+
+template <typename Op, typename F>
+TransformOp<Op, F> transform_op(Op op, F f) {
+  TransformOp<Op, F> t = { op, f };
+  return t;
+}
+
+template <typename Op> struct is_transform : std::false_type {};
+template <typename Op, typename F> struct is_transform<TransformOp<Op, F> > : std::true_type {};
+
+// the operator that combines the partials of op: op itself, or the one a transform wraps
+template <typename Op>
+__host__ __device__ const Op & partial_op(const Op &op) { return op; }
+
+template <typename Op, typename F>
+__host__ __device__ const Op & partial_op(const TransformOp<Op, F> &t) { return t.op; }
+
+// transforms for the common fused reductions: with SumOp, MultiplyBy gives the dot product
+// of the input with b, and CountIf the number of elements that satisfy pred
+template <typename T>
+struct MultiplyBy {
+  const T * b;     // on the device, as long as the input
+  __host__ __device__ T operator()(const T &x, int i) const { return x * b[i]; }
+};
+
+template <typename Pred>
+struct CountIf {
+  Pred pred;
+  template <typename In>
+  __host__ __device__ int operator()(const In &x) const { return pred(x) ? 1 : 0; }
+};
+
+#endif  /* __OPERATORS_H__ */
@@ -1,78 +1,508 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <cuda_runtime.h>
+#include <cuda_fp16.h>
+#include "../common/benchmark.h"
+#include "../common/trace.h"
+#include "autotune.h"
+#include "data_source.h"
+#include "elementwise.h"
+#include "gputimer.h"
+#include "managed.h"
+#include "reduce.h"
+#include "scan.h"
 
-__global__ void global_reduce_kernel(float * d_out, float * d_in) {
-  int myId = threadIdx.x + blockDim.x * blockIdx.x;
-  int tid  = threadIdx.x;
+void print_value(int v)                        { printf("%d", v); }
+void print_value(float v)                      { printf("%f", v); }
+void print_value(double v)                     { printf("%f", v); }
+void print_value(long long v)                  { printf("%lld", v); }
+void print_value(const IndexedValue<float> &v) { printf("%f at %d", v.value, v.index); }
 
-  // do reduction in global mem
-  for (unsigned int s = blockDim.x / 2; s > 0; s >>= 1) {
-    if (tid < s) {
-      d_in[myId] += d_in[myId + s];
-    }
+// the predicate of the count_positive operation
+struct IsPositive {
+  __host__ __device__ bool operator()(float x) const { return x > 0.0f; }
+};
 
-    // make sure all adds at one stage are done!
-    __syncthreads();
+// the same reduction done sequentially on the host, to check the device result against
+template <typename Op, typename In>
+typename Op::value_type host_reduce(const In * h_in, int size, Op op) {
+  typename Op::value_type result = op.identity();
+  for (int i = 0; i < size; i++) {
+    result = op(result, op.lift(h_in[i], i));
   }
+  return result;
+}
 
-  // only thread 0 writes result for this block back to global mem
-  if (tid == 0) {
-    d_out[blockIdx.x] = d_in[myId];
+// the reduction the results are checked against: on the host, or, for input still on the
+// device, there with the multi-pass shuffle kernel, which spares a serial pass over all of it
+template <typename Op, typename In>
+typename Op::value_type reference_reduce(const In * h_in, In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+  if (!d_in) {
+    return host_reduce(h_in, size, op);
   }
+
+  DeviceBuffer<T> intermediate(reduce_intermediate_size(size));
+  DeviceBuffer<T> out(1);
+  reduce(out.get(), intermediate.get(), d_in, size, SHFL_REDUCE, op);
+  T result;
+  cudaMemcpy(&result, out.get(), sizeof(T), cudaMemcpyDeviceToHost);
+  return result;
 }
 
-__global__ void shmem_reduce_kernel(float * d_out, const float * d_in) {
-  // sdata is allocated in the kernel call: 3rd arg to <<<b, t, shmem>>>
-  extern __shared__ float sdata[];
+// the ReduceKernel of a kernel choice other than the streamed one (2) and those past 8
+inline ReduceKernel reduce_kernel_of(int whichKernel) {
+  return (ReduceKernel) (whichKernel < 2 ? whichKernel : whichKernel - 1);
+}
 
-  int myId = threadIdx.x + blockDim.x * blockIdx.x;
-  int tid  = threadIdx.x;
+// runs one reduction with the selected kernel. when h_in is given the input is transferred to
+// the device first, so that the measured time covers the whole end-to-end cost
+template <typename Op, typename In>
+void run_reduce(int whichKernel, typename Op::value_type * d_out, typename Op::value_type * d_intermediate,
+                In * d_in, const In * h_in, int size, ReduceStreams &rs, Op op,
+                const LaunchConfig &launch = default_reduce_launch()) {
+  if (whichKernel == 2) {
+    reduce_streamed(d_out, d_intermediate, d_in, h_in, size, rs, op);
+    return;
+  }
 
-  // load shared mem from global mem
-  sdata[tid] = d_in[myId];
-  // make sure entire block is loaded!
-  __syncthreads();
+  if (h_in) {
+    cudaMemcpy(d_in, h_in, size * sizeof(In), cudaMemcpyHostToDevice);
+  }
+  reduce(d_out, d_intermediate, d_in, size, reduce_kernel_of(whichKernel), op, 0, launch);
+}
 
-  // do reduction in shared mem
-  for (unsigned int s = blockDim.x / 2; s > 0; s >>= 1) {
-    if (tid < s) {
-      sdata[tid] += sdata[tid + s];
+// the launch shape of "kernel" on this many elements, from the tuning file of the device, or
+// else swept on d_in now: block sizes around the one the occupancy calculator suggests, and
+// 1 to 32 elements per thread for the grid-stride kernels
+template <typename Op, typename In>
+LaunchConfig tuned_reduce_launch(TuningFile &tuning, ReduceKernel kernel, In * d_in, int size,
+                                 const std::string &label, Op op) {
+  typedef typename Op::value_type T;
+
+  std::vector<int> blockSizes;
+  switch (kernel) {
+  case FIRST_ADD_REDUCE:   blockSizes = block_size_candidates(first_add_reduce_kernel<Op, In>, sizeof(T), true); break;
+  case GRID_STRIDE_REDUCE: blockSizes = block_size_candidates(grid_stride_reduce_kernel<Op, In>, sizeof(T), true); break;
+  case SHFL_REDUCE:        blockSizes = block_size_candidates(shfl_reduce_kernel<Op, In>, sizeof(T), true); break;
+  case UNROLLED_REDUCE:    blockSizes = block_size_candidates(unrolled_reduce_kernel<1024, Op, In>, sizeof(T), true); break;
+  case ATOMIC_REDUCE:      blockSizes = block_size_candidates(atomic_reduce_kernel<Op, In>, sizeof(T), true); break;
+  case LAST_BLOCK_REDUCE:  blockSizes = block_size_candidates(last_block_reduce_kernel<Op, In>, sizeof(T), true); break;
+  default:
+    // the global memory kernel has the same shape, without the shared memory
+    blockSizes = block_size_candidates(shmem_reduce_kernel<Op, In>, sizeof(T), true);
+    break;
+  }
+  std::vector<int> items(1, ELEMENTS_PER_THREAD);
+  if (kernel >= GRID_STRIDE_REDUCE) {
+    items = { 1, 2, 4, 8, 16, 32 };
+  }
+
+  // the smallest block leaves the most partials
+  LaunchConfig smallest = { blockSizes.front(), 1 };
+  DeviceBuffer<T> intermediate(reduce_intermediate_size(size, smallest));
+  DeviceBuffer<T> out(1);
+  GpuTimer timer;
+  return autotune(tuning, tuningKey("reduce/" + label, size), blockSizes, items, default_reduce_launch(),
+                  [&](const LaunchConfig &launch) {
+                    timer.Start();
+                    reduce(out.get(), intermediate.get(), d_in, size, kernel, op, 0, launch);
+                    timer.Stop();
+                    return (double) timer.Elapsed();
+                  });
+}
+
+// times the reduction sharded over 1, 2, .. up to every visible device, and reports how
+// close each device count comes to a linear speedup over one device
+template <typename Op, typename In>
+void multi_gpu_scaling(const In * h_in, const int ARRAY_SIZE, const std::string &label, Op op) {
+  typedef typename Op::value_type T;
+
+  int deviceCount;
+  cudaGetDeviceCount(&deviceCount);
+  deviceCount = deviceCount < MAX_DEVICES ? deviceCount : MAX_DEVICES;
+
+  cudaSetDevice(0);
+  DeviceBuffer<T> d_out(1);
+
+  double oneDeviceTime = 0;
+  for (int n = 1; n <= deviceCount; n++) {
+    ReduceShards<Op, In> rs(n, ARRAY_SIZE);
+    rs.load(h_in);
+
+    // the devices are timed together on the host clock
+    char name[32];
+    snprintf(name, sizeof(name), "/devices=%d", rs.count);
+    BenchmarkResult result = Benchmark("reduce", label + name)
+      .bytes((double) ARRAY_SIZE * sizeof(In)).elements(ARRAY_SIZE)
+      .run([&] {
+        return wallTime([&] {
+          reduce_multi(d_out.get(), rs, op);
+          cudaStreamSynchronize(rs.streams[0]);
+        });
+      });
+
+    if (n == 1) {
+      oneDeviceTime = result.median;
     }
-    // make sure all adds at one stage are done!
-    __syncthreads();
+
+    T h_out;
+    cudaMemcpy(&h_out, d_out.get(), sizeof(T), cudaMemcpyDeviceToHost);
+
+    double speedup = oneDeviceTime / result.median;
+    printf("%d device(s), %d of %d partials peer to peer: ", rs.count, rs.peer_count(), rs.count - 1);
+    print_value(h_out);
+    printf("\n  speedup: %.2fx, scaling efficiency: %.1f%%\n", speedup, 100.0 * speedup / rs.count);
   }
+}
 
-  // only thread 0 writes result for this block back to global mem
-  if (tid == 0) {
-    d_out[blockIdx.x] = sdata[0];
+// the benchmark with the input in managed memory instead of copied explicitly. a first launch
+// on pages still on the host pays for the migration through page faults; after that the
+// prefetch and the kernels are timed apart, the kernels with the input advised read-mostly
+template <typename Op, typename In>
+void benchmark_managed(int whichKernel, const In * h_in, const int ARRAY_SIZE, const std::string &label,
+                       typename Op::value_type expected, Op op) {
+  typedef typename Op::value_type T;
+  const size_t ARRAY_BYTES = (size_t) ARRAY_SIZE * sizeof(In);
+
+  int dev;
+  cudaGetDevice(&dev);
+  if (!managed_hints_supported(dev)) {
+    printf("no concurrent managed access: prefetch and advice are ignored\n");
   }
+
+  // the host writes the input into managed memory, so its pages start out on the host
+  ManagedBuffer<In> in(ARRAY_SIZE);
+  memcpy(in.get(), h_in, ARRAY_BYTES);
+
+  DeviceBuffer<T> intermediate(reduce_intermediate_size(ARRAY_SIZE));
+  DeviceBuffer<T> out(1);
+
+  const int NUM_STREAMS = 4;
+  ReduceStreams rs(NUM_STREAMS);
+  GpuTimer timer;
+
+  // one launch on demand-paged input: the faults migrate exactly the pages the kernel reads.
+  // only the first launch faults, so this one cannot be repeated
+  timer.Start();
+  run_reduce(whichKernel, out.get(), intermediate.get(), in.get(), (const In *) NULL, ARRAY_SIZE, rs, op);
+  timer.Stop();
+  Benchmark("reduce", label + "/managed/demand_paged").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).warmup(0)
+    .record(std::vector<double>(1, timer.Elapsed()));
+
+  // back to the host, then ahead of time to the device, as a real pipeline would after the
+  // host produced new input. this runs before the read-mostly advice: under it the prefetch to
+  // the host only adds a copy there, and the one on the device stays valid
+  Benchmark("reduce", label + "/managed/prefetch").bytes(ARRAY_BYTES).run([&] {
+    in.prefetch(cudaCpuDeviceId);
+    cudaDeviceSynchronize();
+    timer.Start();
+    in.prefetch(dev);
+    timer.Stop();
+    return timer.Elapsed();
+  });
+
+  in.advise_read_mostly();
+  in.prefetch(dev);
+  Benchmark("reduce", label + "/managed/kernels").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+    timer.Start();
+    run_reduce(whichKernel, out.get(), intermediate.get(), in.get(), (const In *) NULL, ARRAY_SIZE, rs, op);
+    timer.Stop();
+    return timer.Elapsed();
+  });
+
+  // the global memory kernel reduced the input in place, so the result is checked on one more
+  // run over the input written again
+  cudaDeviceSynchronize();
+  memcpy(in.get(), h_in, ARRAY_BYTES);
+  in.prefetch(dev);
+  run_reduce(whichKernel, out.get(), intermediate.get(), in.get(), (const In *) NULL, ARRAY_SIZE, rs, op);
+
+  T h_out;
+  cudaMemcpy(&h_out, out.get(), sizeof(T), cudaMemcpyDeviceToHost);
+
+  printf("result: ");
+  print_value(h_out);
+  printf(" (expected: ");
+  print_value(expected);
+  printf(")\n");
 }
 
-void reduce(float * d_out, float * d_intermediate, float * d_in, int size, bool usesSharedMemory) {
-  // assumes that size is not greater than maxThreadsPerBlock^2
-  // and that size is a multiple of maxThreadsPerBlock
-  const int maxThreadsPerBlock = 1024;
-  int threads = maxThreadsPerBlock;
-  int blocks = size / maxThreadsPerBlock;
-  
-  if (usesSharedMemory) {
-    shmem_reduce_kernel<<<blocks, threads, threads * sizeof(float)>>>(d_intermediate, d_in);
-  } else {
-    global_reduce_kernel<<<blocks, threads>>>(d_intermediate, d_in);
-  }
-  
-  // now we're down to one block left, so reduce it
-  // launch one thread for each block in prev step
-  threads = blocks;
-  blocks = 1;
-  if (usesSharedMemory) {
-    shmem_reduce_kernel<<<blocks, threads, threads * sizeof(float)>>>(d_out, d_intermediate);
-  } else {
-    global_reduce_kernel<<<blocks, threads>>>(d_out, d_intermediate);
+// times an inclusive and an exclusive scan of the input; the last inclusive prefix is the
+// reduction of the whole input, which is checked against the host
+template <typename Op, typename In>
+void benchmark_scan(ScanKernel kernel, const In * h_in, const int ARRAY_SIZE, const std::string &label,
+                    typename Op::value_type expected, Op op) {
+  typedef typename Op::value_type T;
+  const size_t ARRAY_BYTES = (size_t) ARRAY_SIZE * sizeof(In);
+
+  DeviceBuffer<In> in(ARRAY_SIZE);
+  DeviceBuffer<T> out(ARRAY_SIZE);
+  cudaMemcpy(in.get(), h_in, ARRAY_BYTES, cudaMemcpyHostToDevice);
+
+  // a scan reads the input and writes as many values
+  GpuTimer timer;
+  double bytes = ARRAY_BYTES + (double) ARRAY_SIZE * sizeof(T);
+  Benchmark("reduce", label + "/exclusive").bytes(bytes).elements(ARRAY_SIZE).run([&] {
+    timer.Start();
+    exclusive_scan(out.get(), in.get(), ARRAY_SIZE, kernel, op);
+    timer.Stop();
+    return timer.Elapsed();
+  });
+  Benchmark("reduce", label + "/inclusive").bytes(bytes).elements(ARRAY_SIZE).run([&] {
+    timer.Start();
+    inclusive_scan(out.get(), in.get(), ARRAY_SIZE, kernel, op);
+    timer.Stop();
+    return timer.Elapsed();
+  });
+
+  T h_last;
+  cudaMemcpy(&h_last, out.get() + ARRAY_SIZE - 1, sizeof(T), cudaMemcpyDeviceToHost);
+
+  printf("last inclusive prefix: ");
+  print_value(h_last);
+  printf(" (expected: ");
+  print_value(expected);
+  printf(")\n");
+}
+
+// latency of one reduce() replayed from a CUDA graph against the same reduce() launched
+// kernel by kernel. the graph is captured once from a stream and instantiated once, so a
+// replay is a single launch call whatever the number of passes. each mode is timed on the
+// host clock, both synchronizing after every reduction and for REPLAYS reductions back to
+// back, where only the launch overhead is left between the kernels
+template <typename Op, typename In>
+void benchmark_graph(ReduceKernel kernel, const In * h_in, const int ARRAY_SIZE, const std::string &label,
+                     typename Op::value_type expected, Op op) {
+  typedef typename Op::value_type T;
+  const size_t ARRAY_BYTES = (size_t) ARRAY_SIZE * sizeof(In);
+  const int REPLAYS = 100;
+
+  DeviceBuffer<In> in(ARRAY_SIZE);
+  DeviceBuffer<T> intermediate(reduce_intermediate_size(ARRAY_SIZE));
+  DeviceBuffer<T> out(1);
+  cudaMemcpy(in.get(), h_in, ARRAY_BYTES, cudaMemcpyHostToDevice);
+
+  // the legacy default stream cannot be captured
+  cudaStream_t stream;
+  cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking);
+
+  cudaGraph_t graph;
+  cudaGraphExec_t exec;
+  cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal);
+  reduce(out.get(), intermediate.get(), in.get(), ARRAY_SIZE, kernel, op, stream);
+  if (cudaStreamEndCapture(stream, &graph) != cudaSuccess ||
+      cudaGraphInstantiateWithFlags(&exec, graph, 0) != cudaSuccess) {
+    fprintf(stderr, "error: cannot capture the reduction: %s\n", cudaGetErrorString(cudaGetLastError()));
+    exit(EXIT_FAILURE);
   }
+  size_t nodes = 0;
+  cudaGraphGetNodes(graph, NULL, &nodes);
+
+  double bytes = (double) ARRAY_BYTES;
+  BenchmarkResult plain = Benchmark("reduce", label + "/graph/plain_latency").bytes(bytes).elements(ARRAY_SIZE)
+    .run([&] {
+      return wallTime([&] {
+        reduce(out.get(), intermediate.get(), in.get(), ARRAY_SIZE, kernel, op, stream);
+        cudaStreamSynchronize(stream);
+      });
+    });
+  BenchmarkResult replay = Benchmark("reduce", label + "/graph/replay_latency").bytes(bytes).elements(ARRAY_SIZE)
+    .run([&] {
+      return wallTime([&] {
+        cudaGraphLaunch(exec, stream);
+        cudaStreamSynchronize(stream);
+      });
+    });
+
+  // per reduction, out of REPLAYS in a row
+  BenchmarkResult plainBatch = Benchmark("reduce", label + "/graph/plain_batch").bytes(bytes).elements(ARRAY_SIZE)
+    .run([&] {
+      return wallTime([&] {
+        for (int i = 0; i < REPLAYS; i++) {
+          reduce(out.get(), intermediate.get(), in.get(), ARRAY_SIZE, kernel, op, stream);
+        }
+        cudaStreamSynchronize(stream);
+      }) / REPLAYS;
+    });
+  BenchmarkResult replayBatch = Benchmark("reduce", label + "/graph/replay_batch").bytes(bytes).elements(ARRAY_SIZE)
+    .run([&] {
+      return wallTime([&] {
+        for (int i = 0; i < REPLAYS; i++) {
+          cudaGraphLaunch(exec, stream);
+        }
+        cudaStreamSynchronize(stream);
+      }) / REPLAYS;
+    });
+
+  // the global memory kernel reduced the input in place, so the result is checked on one more
+  // replay over the input copied again
+  cudaMemcpyAsync(in.get(), h_in, ARRAY_BYTES, cudaMemcpyHostToDevice, stream);
+  cudaGraphLaunch(exec, stream);
+  cudaStreamSynchronize(stream);
+
+  T h_out;
+  cudaMemcpy(&h_out, out.get(), sizeof(T), cudaMemcpyDeviceToHost);
+
+  printf("graph of %d node(s): latency %.2fx, back to back %.2fx of plain launches\n", (int) nodes,
+         replay.median / plain.median, replayBatch.median / plainBatch.median);
+  printf("result: ");
+  print_value(h_out);
+  printf(" (expected: ");
+  print_value(expected);
+  printf(")\n");
+
+  cudaGraphExecDestroy(exec);
+  cudaGraphDestroy(graph);
+  cudaStreamDestroy(stream);
 }
 
+// how benchmark() runs the kernels
+enum RunMode {
+  EXPLICIT_MODE,          // input copied into device memory
+  MANAGED_MODE,           // input in managed memory
+  GRAPH_MODE              // input copied into device memory, reduce() replayed from a CUDA graph
+};
+
+// times the selected kernel on up to "requestedSize" elements of type In from the chosen
+// source, reduced with op. "label" names the kernel and the operation in the results
+template <typename Op, typename In>
+void benchmark(int whichKernel, const int requestedSize, const std::string &label, Op op, RunMode mode,
+               const InputSpec &spec) {
+  typedef typename Op::value_type T;
+
+  // the input lives in pinned host memory, so that it can be copied asynchronously
+  HostInput<In> input;
+  DeviceBuffer<In> generated;
+  if (!open_input(input, spec, requestedSize, &generated) || input.size() == 0) {
+    fprintf(stderr, "error: cannot open the input\n");
+    exit(EXIT_FAILURE);
+  }
+  const int ARRAY_SIZE = (int) input.size();
+  const size_t ARRAY_BYTES = input.size() * sizeof(In);
+  const In * h_in = input.get();
+  if (ARRAY_SIZE < requestedSize) {
+    printf("the input file holds only %d elements\n", ARRAY_SIZE);
+  }
+  T expected;
+  {
+    TRACE_RANGE("reference_reduce", TRACE_VERIFICATION);
+    expected = reference_reduce(h_in, generated.get(), ARRAY_SIZE, op);
+  }
+  generated.reset(0);
+
+  if (whichKernel == 9) {
+    printf("expected: ");
+    print_value(expected);
+    printf("\n");
+    multi_gpu_scaling(h_in, ARRAY_SIZE, label, op);
+    return;
+  }
+
+  if (whichKernel == 10 || whichKernel == 11) {
+    benchmark_scan(whichKernel == 10 ? BLELLOCH_SCAN : LOOKBACK_SCAN, h_in, ARRAY_SIZE, label, expected, op);
+    return;
+  }
+
+  if (mode == GRAPH_MODE) {
+    // the streamed reduce synchronizes its streams through the legacy default stream
+    if (whichKernel == 2) {
+      fprintf(stderr, "error: the streamed reduce cannot be captured into a graph\n");
+      exit(EXIT_FAILURE);
+    }
+    benchmark_graph(reduce_kernel_of(whichKernel), h_in, ARRAY_SIZE, label, expected, op);
+    return;
+  }
+
+  if (mode == MANAGED_MODE) {
+    benchmark_managed(whichKernel, h_in, ARRAY_SIZE, label, expected, op);
+    return;
+  }
+
+  // draw the GPU buffers from the pool; they go back to it at the end of the scope
+  DeviceBuffer<In> in(ARRAY_SIZE);
+  In * d_in = in.get();
+
+  // transfer the input array to the GPU
+  {
+    TRACE_RANGE_BYTES("input", TRACE_TRANSFER, ARRAY_BYTES);
+    cudaMemcpy(d_in, h_in, ARRAY_BYTES, cudaMemcpyHostToDevice);
+  }
+
+  // the launch shape of the kernel on this device and size, tuned on the first run; the
+  // streamed reduce keeps its block-aligned segments
+  LaunchConfig launch = default_reduce_launch();
+  if (whichKernel != 2) {
+    int dev;
+    cudaGetDevice(&dev);
+    TuningFile tuning(device_tuning_name(dev));
+    launch = tuned_reduce_launch(tuning, reduce_kernel_of(whichKernel), d_in, ARRAY_SIZE, label, op);
+    printf("launch: up to %d threads per block, %d elements per thread\n", launch.blockSize, launch.itemsPerThread);
+  }
+
+  DeviceBuffer<T> intermediate(reduce_intermediate_size(ARRAY_SIZE, launch));
+  DeviceBuffer<T> out(1);
+  T * d_intermediate = intermediate.get(), * d_out = out.get();
+
+  const int NUM_STREAMS = 4;
+  ReduceStreams rs(NUM_STREAMS);
+  GpuTimer timer;
+
+  // launch the kernels on the input already on the device
+  {
+    TRACE_RANGE("kernels", TRACE_KERNEL);
+    Benchmark("reduce", label + "/kernels").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+      timer.Start();
+      run_reduce(whichKernel, d_out, d_intermediate, d_in, (const In *) NULL, ARRAY_SIZE, rs, op, launch);
+      timer.Stop();
+      return timer.Elapsed();
+    });
+  }
+
+  // launch the kernels again, this time transferring the input before every trial
+  {
+    TRACE_RANGE("end_to_end", TRACE_TRANSFER);
+    Benchmark("reduce", label + "/end_to_end").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+      timer.Start();
+      run_reduce(whichKernel, d_out, d_intermediate, d_in, h_in, ARRAY_SIZE, rs, op, launch);
+      timer.Stop();
+      TRACE_BYTES(TRACE_TRANSFER, ARRAY_BYTES);
+      return timer.Elapsed();
+    });
+  }
+
+  // copy back the result from GPU
+  T h_out;
+  {
+    TRACE_RANGE_BYTES("result", TRACE_TRANSFER, sizeof(T));
+    cudaMemcpy(&h_out, d_out, sizeof(T), cudaMemcpyDeviceToHost);
+  }
+
+  printf("result: ");
+  print_value(h_out);
+  printf(" (expected: ");
+  print_value(expected);
+  printf(")\n");
+
+  // compare the single-pass kernels against the multi-pass path with the same block reduction
+  if (whichKernel >= 7) {
+    Benchmark("reduce", label + "/multi_pass_shfl").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+      timer.Start();
+      reduce(d_out, d_intermediate, d_in, ARRAY_SIZE, SHFL_REDUCE, op);
+      timer.Stop();
+      return timer.Elapsed();
+    });
+  }
+}
+
+// the names of the kernel choices in the benchmark results
+const char * kernel_names[] = {
+  "global", "shmem", "streamed", "first_add", "grid_stride", "shfl", "unrolled", "atomic", "last_block", "multi_gpu",
+  "blelloch_scan", "lookback_scan"
+};
+
 int main(int argc, char** argv) {
   int deviceCount;
   cudaGetDeviceCount(&deviceCount);
@@ -80,7 +510,9 @@ int main(int argc, char** argv) {
     fprintf(stderr, "error: no devices supporting CUDA.\n");
     exit(EXIT_FAILURE);
   }
-  
+
+  // the multi-GPU reduction (kernel 9) uses all of them; everything else runs on the first
+  printf("%d device(s) supporting CUDA\n", deviceCount);
   int dev = 0;
   cudaSetDevice(dev);
 
@@ -88,82 +520,140 @@ int main(int argc, char** argv) {
   if (cudaGetDeviceProperties(&devProps, dev) == 0) {
     printf("Using device %d:\n", dev);
     printf("%s; global mem: %dB; compute v%d.%d; clock: %d kHz\n",
-           devProps.name, (int)devProps.totalGlobalMem, 
-           (int)devProps.major, (int)devProps.minor, 
+           devProps.name, (int)devProps.totalGlobalMem,
+           (int)devProps.major, (int)devProps.minor,
            (int)devProps.clockRate);
   }
 
-  const int ARRAY_SIZE = 1 << 20;
-  const int ARRAY_BYTES = ARRAY_SIZE * sizeof(float);
-
-  // generate the input array on the host
-  float h_in[ARRAY_SIZE];
-  float sum = 0.0f;
-  for(int i = 0; i < ARRAY_SIZE; i++) {
-    // generate random float in [-1.0f, 1.0f]
-    h_in[i] = -1.0f + (float)random()/((float)RAND_MAX/2.0f);
-    sum += h_in[i];
+  int whichKernel = 0;
+  if (argc >= 2) {
+    whichKernel = atoi(argv[1]);
   }
 
-  // declare GPU memory pointers
-  float * d_in, * d_intermediate, * d_out;
+  // any size works, including ones that are not a multiple of the block size
+  int ARRAY_SIZE = 1 << 20;
+  if (argc >= 3) {
+    ARRAY_SIZE = atoi(argv[2]);
+  }
 
-  // allocate GPU memory
-  cudaMalloc((void **) &d_in, ARRAY_BYTES);
-  cudaMalloc((void **) &d_intermediate, ARRAY_BYTES); // overallocated
-  cudaMalloc((void **) &d_out, sizeof(float));
+  // the aggregate to compute: sum, min, max, argmax, sum_double, sum_int64, sum_half, or one
+  // with a transform fused into the loads: sum_squares or count_positive
+  const char * operation = "sum";
+  if (argc >= 4) {
+    operation = argv[3];
+  }
 
-  // transfer the input array to the GPU
-  cudaMemcpy(d_in, h_in, ARRAY_BYTES, cudaMemcpyHostToDevice); 
+  // where the input lives: "explicit" copies it into device memory, "managed" uses managed
+  // memory, "graph" copies it and replays reduce() from a CUDA graph (neither for the
+  // multi-GPU reduce and the scans, which always copy explicitly and launch plainly)
+  RunMode mode = EXPLICIT_MODE;
+  if (argc >= 5) {
+    if (strcmp(argv[4], "managed") == 0) {
+      mode = MANAGED_MODE;
+    } else if (strcmp(argv[4], "graph") == 0) {
+      mode = GRAPH_MODE;
+    } else if (strcmp(argv[4], "explicit") != 0) {
+      fprintf(stderr, "error: unknown memory mode %s\n", argv[4]);
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  int whichKernel = 0;
-  if (argc == 2) {
-    whichKernel = atoi(argv[1]);
+  // where the input comes from: "host" generates it with random() (the default), "curand" on
+  // the device, anything else names a file of raw elements, which bounds the size
+  InputSpec spec = { HOST_RANDOM_INPUT, NULL, 1234ULL };
+  if (argc >= 6) {
+    if (strcmp(argv[5], "curand") == 0) {
+      spec.source = CURAND_INPUT;
+    } else if (strcmp(argv[5], "host") != 0) {
+      spec.source = FILE_INPUT;
+      spec.path = argv[5];
+    }
   }
-      
-  cudaEvent_t start, stop;
-  cudaEventCreate(&start);
-  cudaEventCreate(&stop);
-  // launch the kernel
+
   switch(whichKernel) {
   case 0:
     printf("Running global reduce\n");
-    cudaEventRecord(start, 0);
-    for (int i = 0; i < 100; i++) {
-      reduce(d_out, d_intermediate, d_in, ARRAY_SIZE, false);
-    }
-    cudaEventRecord(stop, 0);
     break;
-  
+
   case 1:
     printf("Running reduce with shared mem\n");
-    cudaEventRecord(start, 0);
-    for (int i = 0; i < 100; i++) {
-      reduce(d_out, d_intermediate, d_in, ARRAY_SIZE, true);
-    }
-    cudaEventRecord(stop, 0);
     break;
-  
+
+  case 2:
+    printf("Running streamed reduce with shared mem\n");
+    break;
+
+  case 3:
+    printf("Running reduce with first add during load\n");
+    break;
+
+  case 4:
+    printf("Running grid-stride reduce with %d elements per thread\n", ELEMENTS_PER_THREAD);
+    break;
+
+  case 5:
+    printf("Running grid-stride reduce with warp shuffle tail\n");
+    break;
+
+  case 6:
+    printf("Running unrolled grid-stride reduce with warp shuffle tail\n");
+    break;
+
+  case 7:
+    printf("Running single-pass reduce with atomics\n");
+    break;
+
+  case 8:
+    printf("Running single-pass reduce with last block done\n");
+    break;
+
+  case 9:
+    printf("Running multi-GPU reduce with peer-to-peer combine\n");
+    break;
+
+  case 10:
+    printf("Running Blelloch scan in shared memory\n");
+    break;
+
+  case 11:
+    printf("Running single-pass scan with decoupled look-back\n");
+    break;
+
   default:
     fprintf(stderr, "error: ran no kernel\n");
     exit(EXIT_FAILURE);
   }
-  
-  cudaEventSynchronize(stop);
-  float elapsedTime;
-  cudaEventElapsedTime(&elapsedTime, start, stop);    
-  elapsedTime /= 100.0f;      // 100 trials
 
-  // copy back the sum from GPU
-  float h_out;
-  cudaMemcpy(&h_out, d_out, sizeof(float), cudaMemcpyDeviceToHost);
-
-  printf("average time elapsed: %f\n", elapsedTime);
+  printf("Computing %s over %d elements in %s memory\n", operation, ARRAY_SIZE,
+         mode == MANAGED_MODE ? "managed" : "device");
+  std::string label = std::string(kernel_names[whichKernel]) + "/" + operation;
+  if (strcmp(operation, "sum") == 0) {
+    benchmark<SumOp<float>, float>(whichKernel, ARRAY_SIZE, label, SumOp<float>(), mode, spec);
+  } else if (strcmp(operation, "min") == 0) {
+    benchmark<MinOp<float>, float>(whichKernel, ARRAY_SIZE, label, MinOp<float>(), mode, spec);
+  } else if (strcmp(operation, "max") == 0) {
+    benchmark<MaxOp<float>, float>(whichKernel, ARRAY_SIZE, label, MaxOp<float>(), mode, spec);
+  } else if (strcmp(operation, "argmax") == 0) {
+    benchmark<ArgMaxOp<float>, float>(whichKernel, ARRAY_SIZE, label, ArgMaxOp<float>(), mode, spec);
+  } else if (strcmp(operation, "sum_double") == 0) {
+    benchmark<SumOp<double>, double>(whichKernel, ARRAY_SIZE, label, SumOp<double>(), mode, spec);
+  } else if (strcmp(operation, "sum_int64") == 0) {
+    benchmark<SumOp<long long>, long long>(whichKernel, ARRAY_SIZE, label, SumOp<long long>(), mode, spec);
+  } else if (strcmp(operation, "sum_half") == 0) {
+    // half precision input, accumulated in float
+    benchmark<SumOp<float>, __half>(whichKernel, ARRAY_SIZE, label, SumOp<float>(), mode, spec);
+  } else if (strcmp(operation, "sum_squares") == 0) {
+    typedef TransformOp<SumOp<float>, SquareOp> SumSquares;
+    benchmark<SumSquares, float>(whichKernel, ARRAY_SIZE, label, transform_op(SumOp<float>(), SquareOp()), mode, spec);
+  } else if (strcmp(operation, "count_positive") == 0) {
+    typedef TransformOp<SumOp<int>, CountIf<IsPositive> > CountPositive;
+    CountIf<IsPositive> positive = { IsPositive() };
+    benchmark<CountPositive, float>(whichKernel, ARRAY_SIZE, label, transform_op(SumOp<int>(), positive), mode, spec);
+  } else {
+    fprintf(stderr, "error: unknown operation %s\n", operation);
+    exit(EXIT_FAILURE);
+  }
 
-  // free GPU memory allocation
-  cudaFree(d_in);
-  cudaFree(d_intermediate);
-  cudaFree(d_out);
-      
+  TRACE_DUMP();
   return 0;
 }
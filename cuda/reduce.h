@@ -0,0 +1,787 @@
+#ifndef __REDUCE_H__
+#define __REDUCE_H__
+
+#include <string.h>
+#include <type_traits>
+#include <cuda_runtime.h>
+#include "../common/trace.h"
+#include "../common/tuning.h"
+#include "device_pool.h"
+#include "operators.h"
+
+/*
+ * reduction kernels and the multi-pass driver, templated on the operator (see operators.h)
+ * and on the input element type In. the first pass reads In and lifts it into the operator's
+ * value_type, every later pass combines value_type partials. a TransformOp (see operators.h)
+ * transforms the input in the first pass only; the later passes run with its partial_op().
+ */
+
+// shared memory of a block as an array of T; extern __shared__ arrays cannot be redeclared
+// with a different type in every template instantiation
+template <typename T>
+__device__ T * shared_memory() {
+  extern __shared__ __align__(16) unsigned char smem[];
+  return reinterpret_cast<T *>(smem);
+}
+
+// __shfl_down_sync for any type, moved one 32-bit word at a time
+template <typename T>
+__device__ T shfl_down(T val, int offset) {
+  const int words = (sizeof(T) + sizeof(int) - 1) / sizeof(int);
+  int w[words] = {};
+  memcpy(w, &val, sizeof(T));
+  for (int i = 0; i < words; i++) {
+    w[i] = __shfl_down_sync(0xffffffff, w[i], offset);
+  }
+  memcpy(&val, w, sizeof(T));
+  return val;
+}
+
+// combines "val" across the 32 lanes of a warp through registers, no shared memory or
+// __syncthreads() needed; lane 0 ends up with the total
+template <typename T, typename Op>
+__device__ T warp_reduce(T val, Op op) {
+  for (int offset = warpSize / 2; offset > 0; offset >>= 1) {
+    val = op(val, shfl_down(val, offset));
+  }
+  return val;
+}
+
+// reduces in place, so the input must already be of the operator's type
+template <typename Op>
+__global__ void global_reduce_kernel(typename Op::value_type * d_out, typename Op::value_type * d_in,
+                                     int size, Op op) {
+  int myId = threadIdx.x + blockDim.x * blockIdx.x;
+  int tid  = threadIdx.x;
+
+  // do reduction in global mem; elements past the end count as the identity
+  for (unsigned int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (tid < s && myId + s < size) {
+      d_in[myId] = op(d_in[myId], d_in[myId + s]);
+    }
+
+    // make sure all adds at one stage are done!
+    __syncthreads();
+  }
+
+  // only thread 0 writes result for this block back to global mem
+  if (tid == 0) {
+    d_out[blockIdx.x] = d_in[myId];
+  }
+}
+
+// "base" is the index of d_in[0] in the whole input, for operators that lift the index
+template <typename Op, typename In>
+__global__ void shmem_reduce_kernel(typename Op::value_type * d_out, const In * d_in, int size, Op op,
+                                    int base = 0) {
+  typedef typename Op::value_type T;
+  // sdata is allocated in the kernel call: 3rd arg to <<<b, t, shmem>>>
+  T * sdata = shared_memory<T>();
+
+  int myId = threadIdx.x + blockDim.x * blockIdx.x;
+  int tid  = threadIdx.x;
+
+  // load shared mem from global mem, padding the tail with the identity
+  sdata[tid] = myId < size ? op.lift(d_in[myId], base + myId) : op.identity();
+  // make sure entire block is loaded!
+  __syncthreads();
+
+  // do reduction in shared mem
+  for (unsigned int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (tid < s) {
+      sdata[tid] = op(sdata[tid], sdata[tid + s]);
+    }
+    // make sure all adds at one stage are done!
+    __syncthreads();
+  }
+
+  // only thread 0 writes result for this block back to global mem
+  if (tid == 0) {
+    d_out[blockIdx.x] = sdata[0];
+  }
+}
+
+// each thread combines two elements while loading, so no thread is idle in the first step
+template <typename Op, typename In>
+__global__ void first_add_reduce_kernel(typename Op::value_type * d_out, const In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+  T * sdata = shared_memory<T>();
+
+  int myId = threadIdx.x + blockDim.x * 2 * blockIdx.x;
+  int tid  = threadIdx.x;
+
+  T sum = myId < size ? op.lift(d_in[myId], myId) : op.identity();
+  if (myId + blockDim.x < size) {
+    sum = op(sum, op.lift(d_in[myId + blockDim.x], myId + blockDim.x));
+  }
+  sdata[tid] = sum;
+  __syncthreads();
+
+  for (unsigned int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (tid < s) {
+      sdata[tid] = op(sdata[tid], sdata[tid + s]);
+    }
+    __syncthreads();
+  }
+
+  if (tid == 0) {
+    d_out[blockIdx.x] = sdata[0];
+  }
+}
+
+// each thread first combines every (gridDim.x * blockDim.x)-th element in a register,
+// so a block reduces as many elements as the grid size leaves to it
+template <typename Op, typename In>
+__global__ void grid_stride_reduce_kernel(typename Op::value_type * d_out, const In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+  T * sdata = shared_memory<T>();
+
+  int tid = threadIdx.x;
+
+  T sum = op.identity();
+  for (int i = threadIdx.x + blockDim.x * blockIdx.x; i < size; i += blockDim.x * gridDim.x) {
+    sum = op(sum, op.lift(d_in[i], i));
+  }
+  sdata[tid] = sum;
+  __syncthreads();
+
+  for (unsigned int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (tid < s) {
+      sdata[tid] = op(sdata[tid], sdata[tid + s]);
+    }
+    __syncthreads();
+  }
+
+  if (tid == 0) {
+    d_out[blockIdx.x] = sdata[0];
+  }
+}
+
+// combines the "val" of every thread of the block through a shared memory tree down to one
+// warp, which finishes with shuffles; thread 0 ends up with the total. needs blockDim.x >= 32
+template <typename T, typename Op>
+__device__ T block_reduce(T val, Op op) {
+  T * sdata = shared_memory<T>();
+  int tid = threadIdx.x;
+
+  sdata[tid] = val;
+  __syncthreads();
+
+  for (unsigned int s = blockDim.x / 2; s > 32; s >>= 1) {
+    if (tid < s) {
+      sdata[tid] = val = op(val, sdata[tid + s]);
+    }
+    __syncthreads();
+  }
+
+  if (tid < 32) {
+    if (blockDim.x >= 64) {
+      val = op(val, sdata[tid + 32]);
+    }
+    val = warp_reduce(val, op);
+  }
+  return val;
+}
+
+// grid-stride load, then a shared memory tree down to one warp, which finishes with shuffles.
+// needs blockDim.x >= 32
+template <typename Op, typename In>
+__global__ void shfl_reduce_kernel(typename Op::value_type * d_out, const In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+
+  T sum = op.identity();
+  for (int i = threadIdx.x + blockDim.x * blockIdx.x; i < size; i += blockDim.x * gridDim.x) {
+    sum = op(sum, op.lift(d_in[i], i));
+  }
+  sum = block_reduce(sum, op);
+
+  if (threadIdx.x == 0) {
+    d_out[blockIdx.x] = sum;
+  }
+}
+
+// combines val into *address atomically; most operators have no native atomic, so this
+// retries a compare-and-swap of the whole 4 or 8 byte value until no other block got in between
+template <typename T, typename Op>
+__device__ void atomic_combine(T * address, T val, Op op) {
+  typedef typename std::conditional<sizeof(T) == 4, unsigned int, unsigned long long>::type Word;
+  static_assert(sizeof(T) == sizeof(Word), "atomic_combine needs a 4 or 8 byte value_type");
+
+  Word * word = reinterpret_cast<Word *>(address);
+  Word old = *word, assumed;
+  do {
+    assumed = old;
+    T current;
+    memcpy(&current, &assumed, sizeof(T));
+    T next = op(current, val);
+    Word desired;
+    memcpy(&desired, &next, sizeof(T));
+    old = atomicCAS(word, assumed, desired);
+  } while (assumed != old);
+}
+
+__device__ inline void atomic_combine(float * address, float val, SumOp<float>) { atomicAdd(address, val); }
+__device__ inline void atomic_combine(int * address, int val, SumOp<int>) { atomicAdd(address, val); }
+
+// single-pass reduction: like shfl_reduce_kernel, but every block combines its partial straight
+// into d_out, which must hold the identity before the launch
+template <typename Op, typename In>
+__global__ void atomic_reduce_kernel(typename Op::value_type * d_out, const In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+
+  T sum = op.identity();
+  for (int i = threadIdx.x + blockDim.x * blockIdx.x; i < size; i += blockDim.x * gridDim.x) {
+    sum = op(sum, op.lift(d_in[i], i));
+  }
+  sum = block_reduce(sum, op);
+
+  if (threadIdx.x == 0) {
+    atomic_combine(d_out, sum, partial_op(op));
+  }
+}
+
+// number of blocks of the current last_block_reduce_kernel launch that are done; the last one
+// resets it, so it is 0 again before the next launch
+__device__ unsigned int reduce_blocks_done = 0;
+
+// single-pass reduction: every block writes its partial to d_partials, and the last block to
+// finish combines all of them into d_out. only one of these may run on a device at a time
+template <typename Op, typename In>
+__global__ void last_block_reduce_kernel(typename Op::value_type * d_out, typename Op::value_type * d_partials,
+                                         const In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+  __shared__ bool isLastBlock;
+
+  T sum = op.identity();
+  for (int i = threadIdx.x + blockDim.x * blockIdx.x; i < size; i += blockDim.x * gridDim.x) {
+    sum = op(sum, op.lift(d_in[i], i));
+  }
+  sum = block_reduce(sum, op);
+
+  if (threadIdx.x == 0) {
+    d_partials[blockIdx.x] = sum;
+    // the partial must be visible to every other block before this block counts as done
+    __threadfence();
+    unsigned int ticket = atomicAdd(&reduce_blocks_done, 1);
+    isLastBlock = ticket == gridDim.x - 1;
+  }
+  __syncthreads();
+
+  if (isLastBlock) {
+    T total = op.identity();
+    for (int i = threadIdx.x; i < gridDim.x; i += blockDim.x) {
+      total = op(total, d_partials[i]);
+    }
+    total = block_reduce(total, op);
+
+    if (threadIdx.x == 0) {
+      *d_out = total;
+      reduce_blocks_done = 0;
+    }
+  }
+}
+
+// the shuffle kernel with the block size known at compile time, so the tree is fully unrolled
+// and the steps a block of that size does not need disappear; also combines pairs during the
+// load. needs blockSize >= 32
+template <unsigned int blockSize, typename Op, typename In>
+__global__ void unrolled_reduce_kernel(typename Op::value_type * d_out, const In * d_in, int size, Op op) {
+  typedef typename Op::value_type T;
+  T * sdata = shared_memory<T>();
+
+  int tid = threadIdx.x;
+
+  T sum = op.identity();
+  for (int i = threadIdx.x + blockSize * 2 * blockIdx.x; i < size; i += blockSize * 2 * gridDim.x) {
+    sum = op(sum, op.lift(d_in[i], i));
+    if (i + blockSize < size) {
+      sum = op(sum, op.lift(d_in[i + blockSize], i + blockSize));
+    }
+  }
+  sdata[tid] = sum;
+  __syncthreads();
+
+  if (blockSize >= 1024) { if (tid < 512) { sdata[tid] = sum = op(sum, sdata[tid + 512]); } __syncthreads(); }
+  if (blockSize >=  512) { if (tid < 256) { sdata[tid] = sum = op(sum, sdata[tid + 256]); } __syncthreads(); }
+  if (blockSize >=  256) { if (tid < 128) { sdata[tid] = sum = op(sum, sdata[tid + 128]); } __syncthreads(); }
+  if (blockSize >=  128) { if (tid <  64) { sdata[tid] = sum = op(sum, sdata[tid +  64]); } __syncthreads(); }
+
+  if (tid < 32) {
+    if (blockSize >= 64) {
+      sum = op(sum, sdata[tid + 32]);
+    }
+    sum = warp_reduce(sum, op);
+  }
+
+  if (tid == 0) {
+    d_out[blockIdx.x] = sum;
+  }
+}
+
+// the kernels reduce() can run each pass with
+enum ReduceKernel {
+  GLOBAL_REDUCE,          // tree in global memory, in place
+  SHMEM_REDUCE,           // tree in shared memory
+  FIRST_ADD_REDUCE,       // first add during the load
+  GRID_STRIDE_REDUCE,     // ELEMENTS_PER_THREAD elements per thread through a grid-stride loop
+  SHFL_REDUCE,            // grid-stride, with a warp shuffle tail
+  UNROLLED_REDUCE,        // grid-stride with first add, unrolled for the block size, shuffle tail
+  ATOMIC_REDUCE,          // single pass, blocks combine their partials with atomics
+  LAST_BLOCK_REDUCE       // single pass, the last block to finish combines the partials
+};
+
+const int maxThreadsPerBlock = 1024;
+const int ELEMENTS_PER_THREAD = 8;
+
+// the launch shape of reduce(): blockSize is the largest block of a pass, any power of two
+// from 32 to maxThreadsPerBlock, and itemsPerThread the elements a thread of the grid-stride
+// kernels covers. the other kernels cover a fixed 1 or 2. can be tuned (see autotune.h)
+inline LaunchConfig default_reduce_launch() {
+  LaunchConfig launch = { maxThreadsPerBlock, ELEMENTS_PER_THREAD };
+  return launch;
+}
+
+// smallest power of two that is not less than n; the tree reductions need one per block
+inline int next_pow2(int n) {
+  int p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+// the most partials one pass over n elements can leave, with one element per thread
+inline int reduce_blocks(int n, const LaunchConfig &launch = default_reduce_launch()) {
+  return (n + launch.blockSize - 1) / launch.blockSize;
+}
+
+// number of value_types reduce() needs in d_intermediate: the partials of the first pass,
+// followed by the partials of the second; later passes ping-pong between these two halves.
+// the launch must be the one reduce() gets
+inline int reduce_intermediate_size(int size, const LaunchConfig &launch = default_reduce_launch()) {
+  int first = reduce_blocks(size, launch);
+  return first + reduce_blocks(first, launch);
+}
+
+// number of elements one thread of the given kernel covers in a pass
+inline int reduce_elements_per_thread(ReduceKernel kernel, int items = ELEMENTS_PER_THREAD) {
+  switch (kernel) {
+  case GLOBAL_REDUCE:
+  case SHMEM_REDUCE:
+    return 1;
+  case FIRST_ADD_REDUCE:
+    return 2;
+  default:
+    return items;
+  }
+}
+
+// whether the kernel reduces everything in one launch instead of one pass per launch
+inline bool reduce_is_single_pass(ReduceKernel kernel) {
+  return kernel == ATOMIC_REDUCE || kernel == LAST_BLOCK_REDUCE;
+}
+
+// launch shape of one pass of the given kernel over n elements
+inline void reduce_pass_shape(ReduceKernel kernel, int n, int &blocks, int &threads,
+                              const LaunchConfig &launch = default_reduce_launch()) {
+  int perThread  = reduce_elements_per_thread(kernel, launch.itemsPerThread);
+  int minThreads = kernel >= SHFL_REDUCE ? 32 : 1;
+
+  threads = (n + perThread - 1) / perThread;
+  threads = threads < launch.blockSize ? next_pow2(threads) : launch.blockSize;
+  threads = threads < minThreads ? minThreads : threads;
+  blocks  = (n + threads * perThread - 1) / (threads * perThread);
+}
+
+template <unsigned int blockSize, typename Op, typename In>
+void launch_unrolled(typename Op::value_type * out, const In * in, int n, int blocks, cudaStream_t stream, Op op) {
+  unrolled_reduce_kernel<blockSize><<<blocks, blockSize, blockSize * sizeof(typename Op::value_type), stream>>>
+    (out, in, n, op);
+}
+
+// the global memory kernel works in place, which only an input of the operator's own type
+// allows, and it never lifts, so it cannot apply a transform either
+template <typename Op, typename In>
+void launch_global(typename Op::value_type * out, In * in, int n, int blocks, int threads, cudaStream_t stream,
+                   Op op, std::true_type) {
+  global_reduce_kernel<<<blocks, threads, 0, stream>>>(out, in, n, op);
+}
+
+// any other input falls back to the shared memory kernel
+template <typename Op, typename In>
+void launch_global(typename Op::value_type * out, In * in, int n, int blocks, int threads, cudaStream_t stream,
+                   Op op, std::false_type) {
+  shmem_reduce_kernel<<<blocks, threads, threads * sizeof(typename Op::value_type), stream>>>(out, in, n, op);
+}
+
+template <typename Op, typename In>
+void launch_reduce_kernel(ReduceKernel kernel, typename Op::value_type * out, In * in, int n,
+                          int blocks, int threads, cudaStream_t stream, Op op) {
+  size_t shmem = threads * sizeof(typename Op::value_type);
+  TRACE_LAUNCHES(1);
+
+  switch (kernel) {
+  case GLOBAL_REDUCE:
+    launch_global(out, in, n, blocks, threads, stream, op,
+                  std::integral_constant<bool, std::is_same<In, typename Op::value_type>::value &&
+                                               !is_transform<Op>::value>());
+    break;
+  case SHMEM_REDUCE:
+    shmem_reduce_kernel<<<blocks, threads, shmem, stream>>>(out, in, n, op);
+    break;
+  case FIRST_ADD_REDUCE:
+    first_add_reduce_kernel<<<blocks, threads, shmem, stream>>>(out, in, n, op);
+    break;
+  case GRID_STRIDE_REDUCE:
+    grid_stride_reduce_kernel<<<blocks, threads, shmem, stream>>>(out, in, n, op);
+    break;
+  case SHFL_REDUCE:
+    shfl_reduce_kernel<<<blocks, threads, shmem, stream>>>(out, in, n, op);
+    break;
+  case UNROLLED_REDUCE:
+    switch (threads) {
+    case 1024: launch_unrolled<1024>(out, in, n, blocks, stream, op); break;
+    case  512: launch_unrolled< 512>(out, in, n, blocks, stream, op); break;
+    case  256: launch_unrolled< 256>(out, in, n, blocks, stream, op); break;
+    case  128: launch_unrolled< 128>(out, in, n, blocks, stream, op); break;
+    case   64: launch_unrolled<  64>(out, in, n, blocks, stream, op); break;
+    case   32: launch_unrolled<  32>(out, in, n, blocks, stream, op); break;
+    }
+    break;
+  default:
+    // the single-pass kernels are launched by reduce_single_pass()
+    break;
+  }
+}
+
+// sets *d_out to "value"; a kernel rather than a copy from the host, so it can be captured
+// into a graph without a host buffer that has to outlive it
+template <typename T>
+__global__ void fill_value_kernel(T * d_out, T value) {
+  *d_out = value;
+}
+
+// whether the identity of op is all zero bytes, so that a memset can seed a result with it
+template <typename Op>
+bool identity_is_zero(Op op) {
+  typename Op::value_type e = op.identity();
+  const unsigned char * bytes = reinterpret_cast<const unsigned char *>(&e);
+  for (size_t i = 0; i < sizeof(e); i++) {
+    if (bytes[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// reduces everything with one launch of a single-pass kernel. d_intermediate holds the
+// partials of the last block variant; the grid stays small enough for one block to combine them.
+// the atomic variant needs d_out seeded with the identity: a memset where it is all zero
+// bytes, as for the sums, the max of unsigned values or the counts, and otherwise a fill
+// kernel, which makes it two launches
+template <typename Op, typename In>
+void reduce_single_pass(typename Op::value_type * d_out, typename Op::value_type * d_intermediate,
+                        In * in, int n, ReduceKernel kernel, Op op, cudaStream_t stream = 0,
+                        const LaunchConfig &launch = default_reduce_launch()) {
+  typedef typename Op::value_type T;
+
+  int blocks, threads;
+  reduce_pass_shape(kernel, n, blocks, threads, launch);
+  blocks = blocks < maxThreadsPerBlock ? blocks : maxThreadsPerBlock;
+  size_t shmem = threads * sizeof(T);
+
+  if (kernel == ATOMIC_REDUCE) {
+    if (identity_is_zero(op)) {
+      cudaMemsetAsync(d_out, 0, sizeof(T), stream);
+      TRACE_LAUNCHES(1);
+    } else {
+      fill_value_kernel<<<1, 1, 0, stream>>>(d_out, op.identity());
+      TRACE_LAUNCHES(2);
+    }
+    atomic_reduce_kernel<<<blocks, threads, shmem, stream>>>(d_out, in, n, op);
+  } else {
+    last_block_reduce_kernel<<<blocks, threads, shmem, stream>>>(d_out, d_intermediate, in, n, op);
+    TRACE_LAUNCHES(1);
+  }
+}
+
+// reduces the n values at "in" into d_out, one pass per launch. each pass writes its partials
+// into the half of d_intermediate that "in" does not point into
+template <typename Op, typename In>
+void reduce_passes(typename Op::value_type * d_out, typename Op::value_type * d_intermediate, int first,
+                   In * in, int n, ReduceKernel kernel, Op op, cudaStream_t stream = 0,
+                   const LaunchConfig &launch = default_reduce_launch()) {
+  typedef typename Op::value_type T;
+  T * halves[2] = { d_intermediate, d_intermediate + first };
+
+  int blocks, threads;
+  reduce_pass_shape(kernel, n, blocks, threads, launch);
+  T * out = blocks == 1 ? d_out : ((void *) in == (void *) halves[0] ? halves[1] : halves[0]);
+
+  launch_reduce_kernel(kernel, out, in, n, blocks, threads, stream, op);
+
+  // the partials of this pass are the input of the next one
+  if (blocks > 1) {
+    reduce_passes(d_out, d_intermediate, first, out, blocks, kernel, partial_op(op), stream, launch);
+  }
+}
+
+// works for any size > 0. d_intermediate must hold reduce_intermediate_size(size, launch)
+// values; the global memory variant reduces d_in in place and so destroys the input.
+// only launches kernels on "stream", so a call can be captured into a CUDA graph
+template <typename Op, typename In>
+void reduce(typename Op::value_type * d_out, typename Op::value_type * d_intermediate, In * d_in, int size,
+            ReduceKernel kernel, Op op, cudaStream_t stream = 0,
+            const LaunchConfig &launch = default_reduce_launch()) {
+  if (reduce_is_single_pass(kernel)) {
+    reduce_single_pass(d_out, d_intermediate, d_in, size, kernel, op, stream, launch);
+  } else {
+    reduce_passes(d_out, d_intermediate, reduce_blocks(size, launch), d_in, size, kernel, op, stream, launch);
+  }
+}
+
+// reduces f(d_in[i]) over every i in the same single pass over d_in, e.g. a sum of squares
+// without the squared array in between; takes the same d_intermediate as reduce()
+template <typename Op, typename F, typename In>
+void transform_reduce(typename Op::value_type * d_out, typename Op::value_type * d_intermediate, In * d_in, int size,
+                      ReduceKernel kernel, Op op, F f, cudaStream_t stream = 0,
+                      const LaunchConfig &launch = default_reduce_launch()) {
+  reduce(d_out, d_intermediate, d_in, size, kernel, transform_op(op, f), stream, launch);
+}
+
+// one block per segment: block s reduces d_in[d_offsets[s]] up to d_offsets[s + 1] into
+// d_out[s], an empty segment to the identity. needs blockDim.x >= 32
+template <typename Op, typename In>
+__global__ void segmented_reduce_kernel(typename Op::value_type * d_out, const In * d_in, const int * d_offsets,
+                                        int segments, Op op) {
+  typedef typename Op::value_type T;
+
+  for (int s = blockIdx.x; s < segments; s += gridDim.x) {
+    int begin = d_offsets[s], end = d_offsets[s + 1];
+    T sum = op.identity();
+    for (int i = begin + threadIdx.x; i < end; i += blockDim.x) {
+      sum = op(sum, op.lift(d_in[i], i - begin));
+    }
+    sum = block_reduce(sum, op);
+
+    if (threadIdx.x == 0) {
+      d_out[s] = sum;
+    }
+    // the next segment of the block reuses the shared memory
+    __syncthreads();
+  }
+}
+
+const int SEGMENTED_REDUCE_THREADS = 256;
+
+// reduces many short arrays packed back to back with one launch, e.g. a batch of small
+// requests: d_offsets holds segments + 1 ascending offsets into d_in. a block per segment
+// only suits segments of up to a few thousand elements; longer ones are better off in reduce()
+template <typename Op, typename In>
+void segmented_reduce(typename Op::value_type * d_out, const In * d_in, const int * d_offsets, int segments,
+                      Op op, cudaStream_t stream = 0) {
+  typedef typename Op::value_type T;
+  int blocks = segments < 65535 ? segments : 65535;
+  if (blocks > 0) {
+    segmented_reduce_kernel<<<blocks, SEGMENTED_REDUCE_THREADS, SEGMENTED_REDUCE_THREADS * sizeof(T), stream>>>
+      (d_out, d_in, d_offsets, segments, op);
+    TRACE_LAUNCHES(1);
+  }
+}
+
+#define MAX_STREAMS 16
+
+// streams of the streamed reduction, each with an event that marks its segment as reduced
+struct ReduceStreams {
+  int count;
+  cudaStream_t streams[MAX_STREAMS];
+  cudaEvent_t done[MAX_STREAMS];
+
+  ReduceStreams(int n) : count(n < MAX_STREAMS ? n : MAX_STREAMS) {
+    for (int s = 0; s < count; s++) {
+      cudaStreamCreate(&streams[s]);
+      cudaEventCreateWithFlags(&done[s], cudaEventDisableTiming);
+    }
+  }
+
+  ~ReduceStreams() {
+    for (int s = 0; s < count; s++) {
+      cudaStreamDestroy(streams[s]);
+      cudaEventDestroy(done[s]);
+    }
+  }
+};
+
+// takes the same d_intermediate as reduce(). h_in must be pinned so that the copies run
+// asynchronously; when it is NULL the input is assumed to be on the device already.
+// segments are whole numbers of blocks, so the partial of block j lands at d_intermediate[j]
+template <typename Op, typename In>
+void reduce_streamed(typename Op::value_type * d_out, typename Op::value_type * d_intermediate, In * d_in,
+                     const In * h_in, int size, ReduceStreams &rs, Op op) {
+  typedef typename Op::value_type T;
+  int first = reduce_blocks(size);
+  int segmentBlocks = (first + rs.count - 1) / rs.count;
+  int segment = segmentBlocks * maxThreadsPerBlock;
+
+  // each stream copies its own segment and reduces it into its slice of d_intermediate,
+  // so the copy of one segment overlaps the reduction of the previous one
+  for (int s = 0; s < rs.count; s++) {
+    int offset = s * segment;
+    if (offset >= size) {
+      break;
+    }
+    int count = size - offset < segment ? size - offset : segment;
+
+    if (h_in) {
+      cudaMemcpyAsync(d_in + offset, h_in + offset, count * sizeof(In),
+                      cudaMemcpyHostToDevice, rs.streams[s]);
+    }
+    shmem_reduce_kernel<<<reduce_blocks(count), maxThreadsPerBlock, maxThreadsPerBlock * sizeof(T),
+                          rs.streams[s]>>>(d_intermediate + s * segmentBlocks, d_in + offset, count, op, offset);
+    cudaEventRecord(rs.done[s], rs.streams[s]);
+    cudaStreamWaitEvent(0, rs.done[s], 0);
+  }
+
+  // combine the partials of all segments once every stream is done
+  reduce_passes(d_out, d_intermediate, first, d_intermediate, first, SHMEM_REDUCE, partial_op(op));
+}
+
+#define MAX_DEVICES 16
+
+// a reduction sharded over the first "n" visible devices: device d holds one contiguous shard
+// of the input and reduces it on its own stream, then the partials are gathered on device 0
+// and combined there. a partial travels with a peer copy when its device has peer access to
+// device 0, and through pinned host memory otherwise
+template <typename Op, typename In>
+struct ReduceShards {
+  typedef typename Op::value_type T;
+
+  int count;
+  int offset[MAX_DEVICES], length[MAX_DEVICES];
+  bool peer[MAX_DEVICES];
+  cudaStream_t streams[MAX_DEVICES];
+  cudaEvent_t done[MAX_DEVICES];      // the partial of device d has been sent
+  cudaEvent_t combined;               // device 0 has read every partial of the last reduction
+  DeviceBuffer<In> d_in[MAX_DEVICES];
+  DeviceBuffer<T> d_intermediate[MAX_DEVICES];
+  DeviceBuffer<T> d_partial[MAX_DEVICES];
+  DeviceBuffer<T> d_partials;         // on device 0, one partial per device
+  DeviceBuffer<T> d_scratch;          // on device 0, the intermediate of the final combine
+  T * h_partials;                     // pinned, for the devices without peer access
+
+  ReduceShards(int n, int size) {
+    count = n < MAX_DEVICES ? n : MAX_DEVICES;
+    count = count < size ? count : size;
+
+    // every shard gets size / count elements, the first ones one more for the remainder
+    int start = 0;
+    for (int d = 0; d < count; d++) {
+      offset[d] = start;
+      length[d] = size / count + (d < size % count ? 1 : 0);
+      start += length[d];
+    }
+
+    for (int d = 0; d < count; d++) {
+      cudaSetDevice(d);
+      cudaStreamCreate(&streams[d]);
+      cudaEventCreateWithFlags(&done[d], cudaEventDisableTiming);
+      d_in[d].reset(length[d]);
+      d_intermediate[d].reset(reduce_intermediate_size(length[d]));
+      d_partial[d].reset(1);
+
+      int canAccess = 0;
+      if (d > 0) {
+        cudaDeviceCanAccessPeer(&canAccess, d, 0);
+      }
+      peer[d] = canAccess != 0;
+      if (peer[d] && cudaDeviceEnablePeerAccess(0, 0) != cudaSuccess) {
+        // an earlier ReduceShards may have enabled it already
+        cudaGetLastError();
+      }
+    }
+
+    cudaSetDevice(0);
+    cudaEventCreateWithFlags(&combined, cudaEventDisableTiming);
+    d_partials.reset(count);
+    d_scratch.reset(reduce_intermediate_size(count));
+    cudaHostAlloc((void **) &h_partials, count * sizeof(T), cudaHostAllocPortable);
+  }
+
+  // the buffers go back to the pool after this, tagged on the legacy default stream of their
+  // device, which does not complete before the work of the destroyed streams
+  ~ReduceShards() {
+    for (int d = 0; d < count; d++) {
+      cudaSetDevice(d);
+      cudaStreamDestroy(streams[d]);
+      cudaEventDestroy(done[d]);
+    }
+
+    cudaSetDevice(0);
+    cudaEventDestroy(combined);
+    cudaFreeHost(h_partials);
+  }
+
+  // copies every shard of the whole input h_in to its device
+  void load(const In * h_in) {
+    for (int d = 0; d < count; d++) {
+      cudaSetDevice(d);
+      cudaMemcpy(d_in[d].get(), h_in + offset[d], length[d] * sizeof(In), cudaMemcpyHostToDevice);
+    }
+    cudaSetDevice(0);
+  }
+
+  int peer_count() const {
+    int n = 0;
+    for (int d = 1; d < count; d++) {
+      n += peer[d];
+    }
+    return n;
+  }
+};
+
+// reduces the input loaded into rs into d_out, which must be on device 0. every device runs
+// the same block-aligned shared memory pass as reduce_streamed(), with its shard's offset as
+// the index base, and never waits for the host; d_out is ready once rs.streams[0] is.
+// leaves device 0 current
+template <typename Op, typename In>
+void reduce_multi(typename Op::value_type * d_out, ReduceShards<Op, In> &rs, Op op) {
+  typedef typename Op::value_type T;
+
+  for (int d = 0; d < rs.count; d++) {
+    cudaSetDevice(d);
+    // the partials of the last reduction must have been read before they are overwritten
+    cudaStreamWaitEvent(rs.streams[d], rs.combined, 0);
+
+    int first = reduce_blocks(rs.length[d]);
+    shmem_reduce_kernel<<<first, maxThreadsPerBlock, maxThreadsPerBlock * sizeof(T), rs.streams[d]>>>
+      (rs.d_intermediate[d].get(), rs.d_in[d].get(), rs.length[d], op, rs.offset[d]);
+
+    // device 0 writes its partial straight into place
+    T * partial = d == 0 ? rs.d_partials.get() : rs.d_partial[d].get();
+    reduce_passes(partial, rs.d_intermediate[d].get(), first, rs.d_intermediate[d].get(), first, SHMEM_REDUCE,
+                  partial_op(op), rs.streams[d]);
+
+    if (d > 0) {
+      if (rs.peer[d]) {
+        cudaMemcpyPeerAsync(rs.d_partials.get() + d, 0, rs.d_partial[d].get(), d, sizeof(T), rs.streams[d]);
+      } else {
+        cudaMemcpyAsync(rs.h_partials + d, rs.d_partial[d].get(), sizeof(T), cudaMemcpyDeviceToHost, rs.streams[d]);
+      }
+      cudaEventRecord(rs.done[d], rs.streams[d]);
+    }
+  }
+
+  // device 0 waits for every partial, bringing up those staged in host memory, and combines them
+  cudaSetDevice(0);
+  for (int d = 1; d < rs.count; d++) {
+    cudaStreamWaitEvent(rs.streams[0], rs.done[d], 0);
+    if (!rs.peer[d]) {
+      cudaMemcpyAsync(rs.d_partials.get() + d, rs.h_partials + d, sizeof(T), cudaMemcpyHostToDevice, rs.streams[0]);
+    }
+  }
+  reduce_passes(d_out, rs.d_scratch.get(), reduce_blocks(rs.count), rs.d_partials.get(), rs.count, SHMEM_REDUCE,
+                partial_op(op), rs.streams[0]);
+  cudaEventRecord(rs.combined, rs.streams[0]);
+}
+
+#endif  /* __REDUCE_H__ */
@@ -0,0 +1,303 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <string.h>
+#include <cuda_runtime.h>
+#include "device_pool.h"
+#include "operators.h"
+#include "reduce.h"
+
+/*
+ * prefix scans, templated on the same operators (see operators.h) and input element types
+ * as the reduction: out[i] combines the lifted inputs 0 .. i (inclusive) or 0 .. i - 1
+ * (exclusive, out[0] being the identity), always in index order, so the operator only has to
+ * be associative.
+ */
+
+// the kernels scan() can run
+enum ScanKernel {
+  BLELLOCH_SCAN,          // work-efficient tree per block, block totals scanned recursively, then added back
+  LOOKBACK_SCAN           // single pass, every tile looks back at the tiles before it for its prefix
+};
+
+const int SCAN_THREADS = 512;             // a Blelloch tile is two elements per thread
+const int LOOKBACK_THREADS = 256;
+const int LOOKBACK_ITEMS = 8;             // elements per thread of a look-back tile
+
+// skips a shared memory word every 32, so that the strides of the tree do not all hit one bank
+#define SCAN_BANK_OFFSET(i) ((i) >> 5)
+
+// shared memory of a tree over n values, with the padding
+template <typename T>
+inline size_t scan_shared_bytes(int n) {
+  return (n + SCAN_BANK_OFFSET(n) + 1) * sizeof(T);
+}
+
+// exclusive Blelloch scan of the n values in temp (n a power of two, at most 2 * blockDim.x,
+// stored with SCAN_BANK_OFFSET padding): an up-sweep builds the partial sums of a balanced
+// tree in place, then a down-sweep pushes the prefixes back down it. O(n) work in
+// 2 log n steps. returns the total of all n values to every thread
+template <typename T, typename Op>
+__device__ T block_exclusive_scan(T * temp, int n, Op op) {
+  int tid = threadIdx.x;
+  int offset = 1;
+
+  for (int d = n >> 1; d > 0; d >>= 1) {
+    __syncthreads();
+    if (tid < d) {
+      int ai = offset * (2 * tid + 1) - 1;
+      int bi = offset * (2 * tid + 2) - 1;
+      ai += SCAN_BANK_OFFSET(ai);
+      bi += SCAN_BANK_OFFSET(bi);
+      temp[bi] = op(temp[ai], temp[bi]);
+    }
+    offset <<= 1;
+  }
+
+  int last = n - 1 + SCAN_BANK_OFFSET(n - 1);
+  __syncthreads();
+  T total = temp[last];
+  __syncthreads();
+  if (tid == 0) {
+    temp[last] = op.identity();
+  }
+
+  // the right child gets the prefix of its parent combined with its left sibling's sum
+  for (int d = 1; d < n; d <<= 1) {
+    offset >>= 1;
+    __syncthreads();
+    if (tid < d) {
+      int ai = offset * (2 * tid + 1) - 1;
+      int bi = offset * (2 * tid + 2) - 1;
+      ai += SCAN_BANK_OFFSET(ai);
+      bi += SCAN_BANK_OFFSET(bi);
+      T left = temp[ai];
+      temp[ai] = temp[bi];
+      temp[bi] = op(temp[bi], left);
+    }
+  }
+  __syncthreads();
+  return total;
+}
+
+// scans tiles of 2 * blockDim.x elements independently; the total of tile b goes to
+// d_block_sums[b] when that is given
+template <typename Op, typename In>
+__global__ void blelloch_scan_kernel(typename Op::value_type * d_out, typename Op::value_type * d_block_sums,
+                                     const In * d_in, int size, bool inclusive, Op op) {
+  typedef typename Op::value_type T;
+  T * temp = shared_memory<T>();
+
+  int n = 2 * blockDim.x;
+  int base = blockIdx.x * n;
+  int ai = threadIdx.x, bi = threadIdx.x + blockDim.x;
+
+  // load the tile, padding the tail with the identity
+  T a = base + ai < size ? op.lift(d_in[base + ai], base + ai) : op.identity();
+  T b = base + bi < size ? op.lift(d_in[base + bi], base + bi) : op.identity();
+  temp[ai + SCAN_BANK_OFFSET(ai)] = a;
+  temp[bi + SCAN_BANK_OFFSET(bi)] = b;
+
+  T total = block_exclusive_scan(temp, n, op);
+
+  if (base + ai < size) {
+    T prefix = temp[ai + SCAN_BANK_OFFSET(ai)];
+    d_out[base + ai] = inclusive ? op(prefix, a) : prefix;
+  }
+  if (base + bi < size) {
+    T prefix = temp[bi + SCAN_BANK_OFFSET(bi)];
+    d_out[base + bi] = inclusive ? op(prefix, b) : prefix;
+  }
+  if (d_block_sums && threadIdx.x == 0) {
+    d_block_sums[blockIdx.x] = total;
+  }
+}
+
+// puts the exclusive prefix of every tile in front of the tile's own scan
+template <typename T, typename Op>
+__global__ void scan_add_offsets_kernel(T * d_out, const T * d_offsets, int size, Op op) {
+  int base = blockIdx.x * 2 * blockDim.x;
+  T offset = d_offsets[blockIdx.x];
+  for (int i = base + threadIdx.x; i < base + 2 * blockDim.x && i < size; i += blockDim.x) {
+    d_out[i] = op(offset, d_out[i]);
+  }
+}
+
+// the multi-pass scan: tiles, then the scan of their totals (recursively, until it fits
+// one tile), then the totals added back. d_out may be d_in when In is the value_type
+template <typename Op, typename In>
+void blelloch_scan(typename Op::value_type * d_out, const In * d_in, int size, bool inclusive, Op op,
+                   cudaStream_t stream = 0) {
+  typedef typename Op::value_type T;
+  const int tile = 2 * SCAN_THREADS;
+  int blocks = (size + tile - 1) / tile;
+  size_t shmem = scan_shared_bytes<T>(tile);
+
+  if (blocks == 1) {
+    blelloch_scan_kernel<<<1, SCAN_THREADS, shmem, stream>>>(d_out, (T *) NULL, d_in, size, inclusive, op);
+    return;
+  }
+
+  DeviceBuffer<T> sums(blocks, stream);
+  blelloch_scan_kernel<<<blocks, SCAN_THREADS, shmem, stream>>>(d_out, sums.get(), d_in, size, inclusive, op);
+  blelloch_scan(sums.get(), (const T *) sums.get(), blocks, false, partial_op(op), stream);
+  scan_add_offsets_kernel<<<blocks, SCAN_THREADS, 0, stream>>>(d_out, (const T *) sums.get(), size, op);
+}
+
+// the status of a look-back tile
+enum {
+  TILE_INVALID = 0,       // nothing published yet
+  TILE_AGGREGATE = 1,     // the total of the tile alone is published
+  TILE_PREFIX = 2         // the inclusive prefix up to and including the tile is published
+};
+
+// loads and stores that go to L2, where every block sees them, one 32-bit word at a time;
+// the value_type must be a multiple of 4 bytes, which every operator in operators.h is
+template <typename T>
+__device__ T load_volatile(const T * p) {
+  const int words = (sizeof(T) + sizeof(int) - 1) / sizeof(int);
+  int w[words];
+  for (int i = 0; i < words; i++) {
+    w[i] = ((const volatile int *) p)[i];
+  }
+  T v;
+  memcpy(&v, w, sizeof(T));
+  return v;
+}
+
+template <typename T>
+__device__ void store_volatile(T * p, const T &v) {
+  const int words = (sizeof(T) + sizeof(int) - 1) / sizeof(int);
+  int w[words] = {};
+  memcpy(w, &v, sizeof(T));
+  for (int i = 0; i < words; i++) {
+    ((volatile int *) p)[i] = w[i];
+  }
+}
+
+// single-pass scan with decoupled look-back: a tile publishes its own total as soon as it has
+// it, and waits only for the tiles before it to publish either their total or their prefix.
+// the first prefix found ends the look-back, so a tile rarely looks further than a few tiles.
+// tiles are numbered in the order blocks start, through *d_tile_counter, so every tile a block
+// waits for belongs to a block that is already running
+template <typename Op, typename In>
+__global__ void lookback_scan_kernel(typename Op::value_type * d_out, const In * d_in, int size, bool inclusive,
+                                     int * d_flags, typename Op::value_type * d_aggregates,
+                                     typename Op::value_type * d_prefixes, unsigned int * d_tile_counter, Op op) {
+  typedef typename Op::value_type T;
+  T * temp = shared_memory<T>();
+  __shared__ unsigned int s_tile;
+
+  int tid = threadIdx.x;
+  int n = blockDim.x;
+  if (tid == 0) {
+    s_tile = atomicAdd(d_tile_counter, 1);
+  }
+  __syncthreads();
+  unsigned int tile = s_tile;
+  int base = tile * n * LOOKBACK_ITEMS + tid * LOOKBACK_ITEMS;
+
+  // every thread combines its own run of items, then the block scans the run totals
+  T items[LOOKBACK_ITEMS];
+  T sum = op.identity();
+  for (int k = 0; k < LOOKBACK_ITEMS; k++) {
+    int i = base + k;
+    items[k] = i < size ? op.lift(d_in[i], i) : op.identity();
+    sum = op(sum, items[k]);
+  }
+  temp[tid + SCAN_BANK_OFFSET(tid)] = sum;
+  T total = block_exclusive_scan(temp, n, op);
+  T running = temp[tid + SCAN_BANK_OFFSET(tid)];
+
+  // thread 0 finds the prefix of everything before the tile
+  T * s_prefix = &temp[n + SCAN_BANK_OFFSET(n)];
+  if (tid == 0) {
+    T exclusive = op.identity();
+    if (tile == 0) {
+      store_volatile(&d_prefixes[0], total);
+      __threadfence();
+      ((volatile int *) d_flags)[0] = TILE_PREFIX;
+    } else {
+      store_volatile(&d_aggregates[tile], total);
+      __threadfence();
+      ((volatile int *) d_flags)[tile] = TILE_AGGREGATE;
+
+      for (int j = tile - 1; ; j--) {
+        int flag;
+        do {
+          flag = ((volatile int *) d_flags)[j];
+        } while (flag == TILE_INVALID);
+        __threadfence();
+
+        if (flag == TILE_PREFIX) {
+          exclusive = op(load_volatile(&d_prefixes[j]), exclusive);
+          break;
+        }
+        exclusive = op(load_volatile(&d_aggregates[j]), exclusive);
+      }
+
+      store_volatile(&d_prefixes[tile], op(exclusive, total));
+      __threadfence();
+      ((volatile int *) d_flags)[tile] = TILE_PREFIX;
+    }
+    *s_prefix = exclusive;
+  }
+  __syncthreads();
+
+  running = op(*s_prefix, running);
+  for (int k = 0; k < LOOKBACK_ITEMS; k++) {
+    int i = base + k;
+    if (i < size) {
+      if (inclusive) {
+        running = op(running, items[k]);
+        d_out[i] = running;
+      } else {
+        d_out[i] = running;
+        running = op(running, items[k]);
+      }
+    }
+  }
+}
+
+// the tile status lives in pool memory and is cleared before every launch
+template <typename Op, typename In>
+void lookback_scan(typename Op::value_type * d_out, const In * d_in, int size, bool inclusive, Op op,
+                   cudaStream_t stream = 0) {
+  typedef typename Op::value_type T;
+  const int tile = LOOKBACK_THREADS * LOOKBACK_ITEMS;
+  int tiles = (size + tile - 1) / tile;
+
+  // the flags, followed by the tile counter
+  DeviceBuffer<int> flags(tiles + 1, stream);
+  DeviceBuffer<T> aggregates(tiles, stream), prefixes(tiles, stream);
+  cudaMemsetAsync(flags.get(), 0, flags.bytes(), stream);
+
+  lookback_scan_kernel<<<tiles, LOOKBACK_THREADS, scan_shared_bytes<T>(LOOKBACK_THREADS), stream>>>
+    (d_out, d_in, size, inclusive, flags.get(), aggregates.get(), prefixes.get(),
+     (unsigned int *) (flags.get() + tiles), op);
+}
+
+// works for any size > 0
+template <typename Op, typename In>
+void scan(typename Op::value_type * d_out, const In * d_in, int size, bool inclusive, ScanKernel kernel, Op op,
+          cudaStream_t stream = 0) {
+  if (kernel == LOOKBACK_SCAN) {
+    lookback_scan(d_out, d_in, size, inclusive, op, stream);
+  } else {
+    blelloch_scan(d_out, d_in, size, inclusive, op, stream);
+  }
+}
+
+template <typename Op, typename In>
+void inclusive_scan(typename Op::value_type * d_out, const In * d_in, int size, ScanKernel kernel, Op op,
+                    cudaStream_t stream = 0) {
+  scan(d_out, d_in, size, true, kernel, op, stream);
+}
+
+template <typename Op, typename In>
+void exclusive_scan(typename Op::value_type * d_out, const In * d_in, int size, ScanKernel kernel, Op op,
+                    cudaStream_t stream = 0) {
+  scan(d_out, d_in, size, false, kernel, op, stream);
+}
+
+#endif  /* __SCAN_H__ */
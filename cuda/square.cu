@@ -1,48 +1,109 @@
 #include <stdio.h>
-
-__global__ void square(float* d_out, float* d_in) {
-  int idx = threadIdx.x;
-  float f = d_in[idx];
-  d_out[idx] = f * f;
-}
+#include <stdlib.h>
+#include <math.h>
+#include "../common/benchmark.h"
+#include "autotune.h"
+#include "device_pool.h"
+#include "gputimer.h"
+#include "elementwise.h"
+#include "reduce.h"
 
 int main(int argc, char** argv) {
-  const int ARRAY_SIZE = 64;
+  // any size works, the kernel is no longer limited to a single block
+  int ARRAY_SIZE = 64;
+  if (argc == 2) {
+    ARRAY_SIZE = atoi(argv[1]);
+  }
   const int ARRAY_BYTES = ARRAY_SIZE * sizeof(float);
 
   // generate the input array on the host
-  float h_in[ARRAY_SIZE];
+  float * h_in = (float *) malloc(ARRAY_BYTES);
   for(int i = 0; i < ARRAY_SIZE; i++) {
     h_in[i] = float(i);
   }
-  float h_out[ARRAY_SIZE];
+  float * h_out = (float *) malloc(ARRAY_BYTES);
 
-  // declare GPU memory pointers
-  float* d_in;
-  float* d_out;
-
-  // allocate GPU memory
-  cudaMalloc((void**) &d_in, ARRAY_BYTES);
-  cudaMalloc((void**) &d_out, ARRAY_BYTES);
+  // draw the GPU buffers from the pool; they go back to it at the end of main
+  DeviceBuffer<float> in(ARRAY_SIZE), out(ARRAY_SIZE);
+  float* d_in = in.get();
+  float* d_out = out.get();
 
   // transfer the array to the GPU
   cudaMemcpy(d_in, h_in, ARRAY_BYTES, cudaMemcpyHostToDevice);
 
-  // launch the kernel
-  square<<<1, ARRAY_SIZE>>>(d_out, d_in);
+  // the launch shape for this device and size, from its tuning file or swept now
+  GpuTimer timer;
+  TuningFile tuning(device_tuning_name(0));
+  LaunchConfig launch = autotune(tuning, tuningKey("square/transform", ARRAY_SIZE),
+                                 block_size_candidates(transform_kernel<SquareOp>), { 1, 2, 4, 8 },
+                                 default_elementwise_launch(), [&](const LaunchConfig &candidate) {
+                                   timer.Start();
+                                   transform(d_out, d_in, ARRAY_SIZE, SquareOp(), 0, candidate);
+                                   timer.Stop();
+                                   return (double) timer.Elapsed();
+                                 });
+  printf("launch: %d threads per block, %d float4s per thread\n", launch.blockSize, launch.itemsPerThread);
+
+  // launch the kernel, repeatedly, for the statistics
+  Benchmark("square", "transform").bytes(2.0 * ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+    timer.Start();
+    transform(d_out, d_in, ARRAY_SIZE, SquareOp(), 0, launch);
+    timer.Stop();
+    return timer.Elapsed();
+  });
 
   // copy back the result array to the CPU
   cudaMemcpy(h_out, d_out, ARRAY_BYTES, cudaMemcpyDeviceToHost);
 
-  // print out the resulting array
+  // print out the start of the resulting array, and check all of it
+  bool correct = true;
+  for (int i = 0; i < ARRAY_SIZE; i++) {
+    if (i < 64) {
+      printf("%f\t", h_out[i]);
+    }
+    correct = correct && h_out[i] == h_in[i] * h_in[i];
+  }
+  printf("\n%s\n", correct ? "SUCCESS!" : "FAILED!");
+
+  // the sum of squares: first the square above followed by a reduction, which writes the
+  // squares out and reads them back in, then with the square fused into the reduction's loads,
+  // and once more as the dot product of the input with itself
+  DeviceBuffer<float> intermediate(reduce_intermediate_size(ARRAY_SIZE)), sum(1);
+  float unfused, fused, dot;
+  Benchmark("square", "square+reduce").bytes(3.0 * ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+    timer.Start();
+    transform(d_out, d_in, ARRAY_SIZE, SquareOp(), 0, launch);
+    reduce(sum.get(), intermediate.get(), d_out, ARRAY_SIZE, SHFL_REDUCE, SumOp<float>());
+    timer.Stop();
+    return timer.Elapsed();
+  });
+  cudaMemcpy(&unfused, sum.get(), sizeof(float), cudaMemcpyDeviceToHost);
+
+  Benchmark("square", "transform_reduce").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+    timer.Start();
+    transform_reduce(sum.get(), intermediate.get(), d_in, ARRAY_SIZE, SHFL_REDUCE, SumOp<float>(), SquareOp());
+    timer.Stop();
+    return timer.Elapsed();
+  });
+  cudaMemcpy(&fused, sum.get(), sizeof(float), cudaMemcpyDeviceToHost);
+
+  MultiplyBy<float> byInput = { d_in };
+  transform_reduce(sum.get(), intermediate.get(), d_in, ARRAY_SIZE, SHFL_REDUCE, SumOp<float>(), byInput);
+  cudaMemcpy(&dot, sum.get(), sizeof(float), cudaMemcpyDeviceToHost);
+
+  // the device adds in a different order, so the sums only agree up to rounding
+  double expected = 0.0;
   for (int i = 0; i < ARRAY_SIZE; i++) {
-    printf("%f\t", h_out[i]);
+    expected += (double) h_in[i] * h_in[i];
   }
-  printf("\n");
+  double tolerance = 1e-4 * fmax(1.0, expected);
+  bool sumsCorrect = fabs(unfused - expected) <= tolerance && fabs(fused - expected) <= tolerance &&
+                     fabs(dot - expected) <= tolerance;
+  printf("sum of squares: %f unfused, %f fused, %f as a dot product (host: %f)\n%s\n",
+         unfused, fused, dot, expected, sumsCorrect ? "SUCCESS!" : "FAILED!");
 
-  // free GPU memory allocation
-  cudaFree(d_in);
-  cudaFree(d_out);
+  free(h_in);
+  free(h_out);
 
   return 0;
 }
@@ -0,0 +1,90 @@
+#ifndef __CL_TIMER_H__
+#define __CL_TIMER_H__
+
+#include <CL/cl.hpp>
+#include <chrono>
+#include <vector>
+#include "cltrace.h"
+
+// the OpenCL counterpart of cuda/gputimer.h. between Start() and Stop() it measures the host
+// wall time, and collects the events of the commands it is handed, so that the device time
+// of the writes, the kernels and the reads can be told apart. the commands must go to a
+// queue created with CL_QUEUE_PROFILING_ENABLE.
+// commands that overlap, like those of a streamed run, each count in full, so the stages can
+// add up to more than the wall time. built with -DTRACE, Stop() also waits for every command
+// and traces it, so nothing is kept past the run
+struct ClTimer {
+  enum Stage { WRITE, KERNEL, READ, STAGES };
+
+  std::vector<cl::Event> events[STAGES];
+  std::chrono::steady_clock::time_point start, stop;
+#ifdef TRACE
+  std::vector<double> enqueued[STAGES];     // The tracer's clock at every Track() or Record().
+#endif
+
+  void Start() {
+    for(auto& stage : events) {
+      stage.clear();
+    }
+#ifdef TRACE
+    for(auto& stage : enqueued) {
+      stage.clear();
+    }
+#endif
+    start = std::chrono::steady_clock::now();
+  }
+
+  void Stop() {
+    stop = std::chrono::steady_clock::now();
+#ifdef TRACE
+    for(int s = 0; s < STAGES; s++) {
+      for(size_t i = 0; i < events[s].size(); i++) {
+        traceCommand(StageName((Stage) s), StagePhase((Stage) s), events[s][i], enqueued[s][i]);
+      }
+    }
+#endif
+  }
+
+  // an event to pass to an enqueue call, counted in the given stage; only valid for that call
+  cl::Event* Track(Stage stage) {
+#ifdef TRACE
+    enqueued[stage].push_back(Tracer::instance().now());
+#endif
+    events[stage].push_back(cl::Event());
+    return &events[stage].back();
+  }
+
+  // counts an event the caller also needs itself, e.g. to chain queues
+  void Record(Stage stage, const cl::Event& event) {
+#ifdef TRACE
+    enqueued[stage].push_back(Tracer::instance().now());
+#endif
+    events[stage].push_back(event);
+  }
+
+  // device time of the stage in ms, from the START and END of every command; waits for them
+  double Elapsed(Stage stage) {
+    cl_ulong total = 0;
+    for(auto& event : events[stage]) {
+      event.wait();
+      total += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    }
+    return total / 1e6;
+  }
+
+  static const char* StageName(Stage stage) {
+    static const char* names[STAGES] = { "write", "kernel", "read" };
+    return names[stage];
+  }
+
+  static TracePhase StagePhase(Stage stage) {
+    return stage == KERNEL ? TRACE_KERNEL : TRACE_TRANSFER;
+  }
+
+  // host wall time between Start() and Stop() in ms
+  double Wall() const {
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+  }
+};
+
+#endif  /* __CL_TIMER_H__ */
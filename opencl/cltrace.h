@@ -0,0 +1,108 @@
+#ifndef __CL_TRACE_H__
+#define __CL_TRACE_H__
+
+#include "../common/trace.h"
+
+// the OpenCL side of common/trace.h: commands traced through their profiling events, which
+// needs a queue created with CL_QUEUE_PROFILING_ENABLE. a command is put on the host clock
+// by its QUEUED time, taken to be when it was enqueued.
+// TRACE_CL_EVENT(name, phase) is the event to pass to an enqueue call, or nullptr without
+// -DTRACE; traceCommand() adds an event the caller already has, once its command is done
+
+#ifdef TRACE
+
+#include <CL/cl.hpp>
+#include <deque>
+#include <mutex>
+
+// the times of a finished command on the tracer's clock, in us; "enqueued" is the tracer's
+// clock when it was enqueued
+inline bool resolveCommand(const cl::Event& event, double enqueued, double& start, double& duration) {
+  cl_ulong queued, started, ended;
+  if(!event() || event.wait() != CL_SUCCESS || event.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &queued) != CL_SUCCESS ||
+     event.getProfilingInfo(CL_PROFILING_COMMAND_START, &started) != CL_SUCCESS ||
+     event.getProfilingInfo(CL_PROFILING_COMMAND_END, &ended) != CL_SUCCESS) {
+    return false;
+  }
+  start = enqueued + (started - queued) / 1e3;
+  duration = (ended - started) / 1e3;
+  return true;
+}
+
+// traces a command the caller has the event of, waiting for it to finish
+inline void traceCommand(const char* name, TracePhase phase, const cl::Event& event, double enqueued, double bytes = 0) {
+  double start, duration;
+  if(resolveCommand(event, enqueued, start, duration)) {
+    Tracer::instance().deviceRange(name, phase, bytes, start, duration);
+  }
+}
+
+// the events handed out by traceEvent(), in the order they were enqueued. one is traced and
+// dropped once its command completes, so only the commands still in flight are kept; an
+// event must be filled by its enqueue call before the next is handed out
+class TracedCommands {
+public:
+  static TracedCommands& instance() {
+    static TracedCommands commands;
+    return commands;
+  }
+
+  cl::Event* add(const char* name, TracePhase phase) {
+    std::lock_guard<std::mutex> lock(mutex);
+    drain(false);
+    Command command = { cl::Event(), name, phase, Tracer::instance().now() };
+    commands.push_back(command);
+    return &commands.back().event;   // Stable, since a deque only grows at its ends.
+  }
+
+  // traces the commands that completed; with "wait" every one, waiting for those still running
+  void drain(bool wait) {
+    while(!commands.empty()) {
+      Command& command = commands.front();
+      cl_int status;
+      if(!wait && command.event() && command.event.getInfo(CL_EVENT_COMMAND_EXECUTION_STATUS, &status) == CL_SUCCESS &&
+         status > CL_COMPLETE) {
+        return;                         // Still queued or running, and so are the ones behind it.
+      }
+      double start, duration;
+      if(command.event() && resolveCommand(command.event, command.enqueued, start, duration)) {
+        Tracer::instance().deviceRange(command.name, command.phase, 0, start, duration);
+      }
+      commands.pop_front();
+    }
+  }
+
+private:
+  // an event the enqueue call fills in, or leaves empty when it failed
+  struct Command {
+    cl::Event event;
+    const char* name;
+    TracePhase phase;
+    double enqueued;
+  };
+
+  TracedCommands() {
+    Tracer::instance().onDump([this] {
+      std::lock_guard<std::mutex> lock(mutex);
+      drain(true);
+    });
+  }
+
+  std::mutex mutex;
+  std::deque<Command> commands;
+};
+
+// an event for an enqueue call to fill, traced once its command completes
+inline cl::Event* traceEvent(const char* name, TracePhase phase) {
+  return TracedCommands::instance().add(name, phase);
+}
+
+#define TRACE_CL_EVENT(name, phase) traceEvent(name, phase)
+
+#else
+
+#define TRACE_CL_EVENT(name, phase) ((cl::Event*) nullptr)
+
+#endif  /* TRACE */
+
+#endif  /* __CL_TRACE_H__ */
@@ -0,0 +1,108 @@
+#ifndef __DEVICE_H__
+#define __DEVICE_H__
+
+#include <CL/cl.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// device discovery shared by the samples: every available device of every platform, ranked
+// so that a discrete GPU wins over an accelerator, and both over a CPU OpenCL device; within
+// a type more compute units, then more global memory, rank higher.
+// setting $OPENCL_DEVICE overrides the choice, either with an index into the ranking or with
+// part of the device name.
+struct Devices {
+
+  // higher is better
+  static int typeRank(cl_device_type type) {
+    if(type & CL_DEVICE_TYPE_GPU)         return 3;
+    if(type & CL_DEVICE_TYPE_ACCELERATOR) return 2;
+    if(type & CL_DEVICE_TYPE_CPU)         return 1;
+    return 0;
+  }
+
+  static bool isBetter(const cl::Device& a, const cl::Device& b) {
+    auto rankA = typeRank(a.getInfo<CL_DEVICE_TYPE>()), rankB = typeRank(b.getInfo<CL_DEVICE_TYPE>());
+    if(rankA != rankB) {
+      return rankA > rankB;
+    }
+    auto unitsA = a.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>(), unitsB = b.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    if(unitsA != unitsB) {
+      return unitsA > unitsB;
+    }
+    return a.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() > b.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+  }
+
+  // return every available device of every platform, best first
+  static std::vector<cl::Device> ranked() {
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    std::vector<cl::Device> all;
+    for(auto& platform : platforms) {
+      std::vector<cl::Device> found;
+      platform.getDevices(CL_DEVICE_TYPE_ALL, &found);
+      for(auto& device : found) {
+        if(device.getInfo<CL_DEVICE_AVAILABLE>()) {
+          all.push_back(device);
+        }
+      }
+    }
+
+    std::stable_sort(all.begin(), all.end(), isBetter);
+    return all;
+  }
+
+  // return the device picked by $OPENCL_DEVICE, or the best ranked one
+  static cl::Device select() {
+    auto all = ranked();
+    if(all.empty()) {
+      std::cerr << "no devices found!" << std::endl;
+      exit(1);
+    }
+
+    const char* choice = getenv("OPENCL_DEVICE");
+    if(!choice || !*choice) {
+      return all.front();
+    }
+
+    char* end;
+    long index = strtol(choice, &end, 10);
+    if(*end == '\0') {
+      if(index < 0 || index >= (long) all.size()) {
+        std::cerr << "OPENCL_DEVICE=" << choice << " is out of range, there are " << all.size() << " devices" << std::endl;
+        exit(1);
+      }
+      return all[index];
+    }
+
+    for(auto& device : all) {
+      if(device.getInfo<CL_DEVICE_NAME>().find(choice) != std::string::npos) {
+        return device;
+      }
+    }
+    std::cerr << "OPENCL_DEVICE=" << choice << " matches no device" << std::endl;
+    exit(1);
+  }
+
+  // the source of a kernel: embedded at build time when the sample is compiled with
+  // -DEMBED_KERNELS (see the README), otherwise read from the working directory
+  static std::string kernelSource(const char* path, const unsigned char* embedded = nullptr, size_t length = 0) {
+    if(embedded) {
+      return std::string((const char*) embedded, length);
+    }
+
+    std::ifstream file(path);
+    if(!file) {
+      std::cerr << "cannot open " << path << std::endl;
+      exit(1);
+    }
+    return std::string(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
+  }
+};
+
+#endif  /* __DEVICE_H__ */
@@ -1,53 +1,30 @@
 #include <CL/cl.hpp>
 #include <fstream>
 #include <iostream>
+#include "../device.h"
+#include "../program_cache.h"
 
-
-cl::Device get_default_device() {
-  
-  // search for all the OpenCL platforms available and check if there are any
-  std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
-
-  if (platforms.empty()) {
-    std::cerr << "no platforms found!" << std::endl;
-    exit(1);
-  }
-
-  // search for all the devices on the first platform and check if there are any available
-  auto platform = platforms.front();
-  std::vector<cl::Device> devices;
-  platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-
-  if (devices.empty()) {
-    std::cerr << "no devices found!" << std::endl;
-    exit(1);
-  }
-
-  return devices.front();
-}
+#ifdef EMBED_KERNELS
+#include "hello_cl.h"   // generated at build time with: xxd -i hello.cl > hello_cl.h
+static const unsigned char* helloSource = hello_cl;
+static const size_t helloSourceLength = hello_cl_len;
+#else
+static const unsigned char* helloSource = nullptr;
+static const size_t helloSourceLength = 0;
+#endif
 
 
 int main() {
 
   // select a device
-  auto device = get_default_device();
+  auto device = Devices::select();
 
-  // read OpenCL kernel file as a string.
-  std::ifstream hello_world_file("hello.cl");
-  std::string src(std::istreambuf_iterator<char>(hello_world_file), (std::istreambuf_iterator<char>()));
+  // take the embedded kernel source, or read the OpenCL kernel file as a string.
+  std::string src = Devices::kernelSource("hello.cl", helloSource, helloSourceLength);
 
-  // compile the program which will run on the device
-  cl::Program::Sources sources(1, std::make_pair(src.c_str(), src.length() + 1));
+  // compile the program which will run on the device, or load it from a previous run
   cl::Context context(device);
-  cl::Program program(context, sources);
-
-  auto err = program.build();
-  if(err != CL_BUILD_SUCCESS) {
-    std::cerr << "build status:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) << std::endl;
-    std::cerr << "build log   :\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
-    exit(1);
-  }
+  cl::Program program = ProgramCache::build(context, device, src);
   
   // create buffers and allocate memory on the device
   char buf[16];
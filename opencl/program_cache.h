@@ -0,0 +1,146 @@
+#ifndef __PROGRAM_CACHE_H__
+#define __PROGRAM_CACHE_H__
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+
+// stores compiled program binaries on disk, so only the first run on a device pays for the
+// source build. an entry is keyed by the source, the device name, the driver version and the
+// build options; when any of them changes the key does not match and the source is rebuilt.
+// the directory is $CL_PROGRAM_CACHE_DIR, or .clcache in the working directory.
+struct ProgramCache {
+
+  // return the program for the device, loaded from the cache or built from source
+  static cl::Program build(const cl::Context& context, const cl::Device& device,
+                           const std::string& src, const std::string& options = "") {
+    std::string key = makeKey(device, src, options);
+    std::string path = entryPath(key);
+
+    cl::Program program;
+    if(load(context, device, path, key, options, program)) {
+      return program;
+    }
+
+    // compile kernel program which will run on the device
+    cl::Program::Sources sources(1, std::make_pair(src.c_str(), src.length() + 1));
+    program = cl::Program(context, sources);
+
+    auto err = program.build(std::vector<cl::Device>(1, device), options.c_str());
+    if(err != CL_BUILD_SUCCESS) {
+      std::cerr << "build status:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) << std::endl;
+      std::cerr << "build log   :\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+      exit(1);
+    }
+
+    store(program, path, key);
+    return program;
+  }
+
+private:
+
+  // everything a binary depends on, as one string
+  static std::string makeKey(const cl::Device& device, const std::string& src, const std::string& options) {
+    std::ostringstream key;
+    key << device.getInfo<CL_DEVICE_NAME>() << '\n'
+        << device.getInfo<CL_DRIVER_VERSION>() << '\n'
+        << options << '\n'
+        << std::hex << fnv1a(src);
+    return key.str();
+  }
+
+  // 64-bit FNV-1a, stable across runs and standard libraries unlike std::hash
+  static uint64_t fnv1a(const std::string& data) {
+    uint64_t hash = 14695981039346656037ull;
+    for(unsigned char c : data) {
+      hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  static std::string directory() {
+    const char* dir = getenv("CL_PROGRAM_CACHE_DIR");
+    return dir ? dir : ".clcache";
+  }
+
+  static std::string entryPath(const std::string& key) {
+    std::ostringstream path;
+    path << directory() << "/" << std::hex << fnv1a(key) << ".bin";
+    return path.str();
+  }
+
+  // an entry holds the full key, so a hash collision is detected, followed by the binary
+  static bool load(const cl::Context& context, const cl::Device& device, const std::string& path,
+                   const std::string& key, const std::string& options, cl::Program& program) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) {
+      return false;
+    }
+
+    // sizes are checked before anything is allocated, so a truncated entry is just a miss
+    uint64_t keySize = 0, binarySize = 0;
+    file.read((char*) &keySize, sizeof(keySize));
+    if(!file || keySize != key.size()) {
+      return false;
+    }
+    std::string storedKey(keySize, '\0');
+    file.read(&storedKey[0], keySize);
+    file.read((char*) &binarySize, sizeof(binarySize));
+    if(!file || storedKey != key) {
+      return false;
+    }
+
+    std::streampos start = file.tellg();
+    file.seekg(0, std::ios::end);
+    if(uint64_t(file.tellg() - start) != binarySize) {
+      return false;
+    }
+    file.seekg(start);
+    std::vector<unsigned char> binary(binarySize);
+    file.read((char*) binary.data(), binarySize);
+    if(!file) {
+      return false;
+    }
+
+    // a binary still has to be built, but that only links it; any failure falls back to source
+    std::vector<cl::Device> devices(1, device);
+    cl::Program::Binaries binaries(1, std::make_pair((const void*) binary.data(), (size_t) binarySize));
+    std::vector<cl_int> status;
+    cl_int err;
+    program = cl::Program(context, devices, binaries, &status, &err);
+    if(err != CL_SUCCESS || status.empty() || status[0] != CL_SUCCESS) {
+      return false;
+    }
+    return program.build(devices, options.c_str()) == CL_SUCCESS;
+  }
+
+  static void store(const cl::Program& program, const std::string& path, const std::string& key) {
+    // the program was built for exactly one device, so it has exactly one binary
+    size_t binarySize = 0;
+    clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, nullptr);
+    if(binarySize == 0) {
+      return;
+    }
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char* binaryPtr = binary.data();
+    clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaryPtr), &binaryPtr, nullptr);
+
+    // the cache is an optimization, so a directory or file that cannot be written is not an error
+    mkdir(directory().c_str(), 0755);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    uint64_t keySize = key.size(), size = binarySize;
+    file.write((const char*) &keySize, sizeof(keySize));
+    file.write(key.data(), keySize);
+    file.write((const char*) &size, sizeof(size));
+    file.write((const char*) binary.data(), binarySize);
+  }
+};
+
+#endif  /* __PROGRAM_CACHE_H__ */
@@ -0,0 +1,88 @@
+// the reduction kernels of cuda/reduce.h, one pass each: every work-group reduces one element
+// per work-item and writes its partial sum to out[group]; the host runs passes until one is
+// left. the local size must be a power of two
+
+// tree in global memory, in place, like global_reduce_kernel
+__kernel void global_reduce(__global float* data, __global float* out, const int n) {
+
+  int gid = get_global_id(0);
+  int lid = get_local_id(0);
+
+  // elements past the end count as 0
+  for(int s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if(lid < s && gid + s < n) {
+      data[gid] += data[gid + s];
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+  }
+
+  if(lid == 0) {
+    out[get_group_id(0)] = data[gid];
+  }
+}
+
+// tree in local memory, like shmem_reduce_kernel
+__kernel void local_reduce(__global const float* in, __global float* out, const int n, __local float* scratch) {
+
+  int gid = get_global_id(0);
+  int lid = get_local_id(0);
+
+  scratch[lid] = gid < n ? in[gid] : 0.0f;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if(lid < s) {
+      scratch[lid] += scratch[lid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if(lid == 0) {
+    out[get_group_id(0)] = scratch[0];
+  }
+}
+
+// the work-group collective of OpenCL C 2.0, optional from 3.0 on; the driver picks the
+// algorithm, usually subgroup shuffles and a little local memory
+#if (__OPENCL_C_VERSION__ >= 200 && __OPENCL_C_VERSION__ < 300) || defined(__opencl_c_work_group_collective_functions)
+__kernel void work_group_reduce(__global const float* in, __global float* out, const int n) {
+
+  int gid = get_global_id(0);
+  float sum = work_group_reduce_add(gid < n ? in[gid] : 0.0f);
+
+  if(get_local_id(0) == 0) {
+    out[get_group_id(0)] = sum;
+  }
+}
+#endif
+
+// every subgroup reduces in registers, like warp_reduce, and the first subgroup combines
+// their sums from local memory. a subgroup can be narrower than the number of subgroups
+// (Intel runs 8 lanes), so it loops over them
+#if defined(cl_khr_subgroups) || defined(__opencl_c_subgroups)
+#ifdef cl_khr_subgroups
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+__kernel void subgroup_reduce(__global const float* in, __global float* out, const int n, __local float* scratch) {
+
+  int gid = get_global_id(0);
+  int lane = get_sub_group_local_id();
+
+  float sum = sub_group_reduce_add(gid < n ? in[gid] : 0.0f);
+  if(lane == 0) {
+    scratch[get_sub_group_id()] = sum;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if(get_sub_group_id() == 0) {
+    float total = 0.0f;
+    for(int i = lane; i < (int) get_num_sub_groups(); i += get_sub_group_size()) {
+      total += scratch[i];
+    }
+    total = sub_group_reduce_add(total);
+    if(lane == 0) {
+      out[get_group_id(0)] = total;
+    }
+  }
+}
+#endif
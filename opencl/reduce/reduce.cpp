@@ -0,0 +1,283 @@
+#include <CL/cl.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../../common/benchmark.h"
+#include "../cltimer.h"
+#include "../device.h"
+#include "../program_cache.h"
+
+#ifdef EMBED_KERNELS
+#include "reduce_cl.h"  // generated at build time with: xxd -i reduce.cl > reduce_cl.h
+static const unsigned char* reduceSource = reduce_cl;
+static const size_t reduceSourceLength = reduce_cl_len;
+#else
+static const unsigned char* reduceSource = nullptr;
+static const size_t reduceSourceLength = 0;
+#endif
+
+
+// the kernels of reduce.cl; the names are those of the matching cuda/reduce kernels, so the
+// benchmark results of both line up
+enum Variant { GLOBAL_REDUCE, LOCAL_REDUCE, WORK_GROUP_REDUCE, SUBGROUP_REDUCE, VARIANTS };
+const char* variantKernels[VARIANTS] = { "global_reduce", "local_reduce", "work_group_reduce", "subgroup_reduce" };
+const char* variantNames[VARIANTS]   = { "global", "shmem", "work_group", "subgroup" };
+
+
+// keeps the queue, the kernels and the device buffers alive between calls, so that a
+// reduction only enqueues its passes. every pass leaves one partial sum per work-group, and
+// the passes ping-pong between two partials buffers until one sum is left, as reduce_passes
+// does on the CUDA side
+class ReduceExecutor {
+public:
+  ReduceExecutor(const cl::Context& context, const cl::Device& device, const cl::Program& program);
+
+  bool supports(Variant v) const { return available[v]; }  // Whether the program built the kernel for the device.
+  void load(const float* h_in, const int N);                // Write N elements to the input buffer.
+  void run(Variant v, const int N);                         // Reduce the N elements of the input buffer.
+  float result();                                           // Wait for the last reduction and read its sum.
+  size_t getLocalSize() const { return local; }             // Work-items per work-group, a power of two.
+  void setTimer(ClTimer* t) { timer = t; }                  // Track every later command in t, nullptr stops tracking.
+
+private:
+  void reserve(const int N);                                // Grow the buffers so they hold at least N elements.
+  void pass(Variant v, const cl::Buffer& in, const cl::Buffer& out, const int n);  // One partial per work-group of n elements.
+  int groups(const int n) const { return (int) ((n + local - 1) / local); }
+  cl::Event* track(ClTimer::Stage stage) { return timer ? timer->Track(stage) : nullptr; }  // Event for the timer, if any.
+
+  cl::Context context;
+  cl::Device device;
+  cl::CommandQueue queue;
+  cl::Kernel kernels[VARIANTS];
+  bool available[VARIANTS];
+  size_t local;
+  cl::Buffer input, partials[2], sum;
+  int capacity;                                             // Number of elements the input buffer can currently hold.
+
+  ClTimer* timer;                                           // Tracks the commands when set.
+};
+
+
+void initializeDevice();                                  // Initialize the device and compile the kernels.
+double seqReduce(const float* in, const int N);           // Sequentially sums the N elements, in double.
+std::string buildOptions(const cl::Device& device);       // The newest OpenCL C the device compiles.
+
+cl::Program program;    // The program that will run on the device.
+cl::Context context;    // The context which holds the device.
+cl::Device device;      // The device where the kernels will run.
+std::unique_ptr<ReduceExecutor> executor;    // The reusable executor created by initializeDevice().
+
+int main(int argc, char** argv) {
+
+  // "reduce [variant] [size]", every variant the device supports by default
+  std::string which = argc >= 2 ? argv[1] : "all";
+  int ARRAY_SIZE = 1 << 20;
+  if(argc >= 3) {
+    ARRAY_SIZE = atoi(argv[2]);
+  }
+  if(ARRAY_SIZE <= 0) {
+    std::cerr << "error: the size must be positive" << std::endl;
+    exit(1);
+  }
+
+  std::vector<int> variants;
+  for(int v = 0; v < VARIANTS; v++) {
+    if(which == "all" || which == variantNames[v]) {
+      variants.push_back(v);
+    }
+  }
+  if(variants.empty()) {
+    std::cerr << "error: unknown variant " << which << ", expected all, global, shmem, work_group or subgroup" << std::endl;
+    exit(1);
+  }
+
+  // the same input as cuda/reduce: random floats in [-1.0f, 1.0f]
+  std::vector<float> h_in(ARRAY_SIZE);
+  for(auto& x : h_in) {
+    x = -1.0f + (float) random() / ((float) RAND_MAX / 2.0f);
+  }
+  double expected = seqReduce(h_in.data(), ARRAY_SIZE);
+
+  initializeDevice();
+  std::cout << "device: " << device.getInfo<CL_DEVICE_NAME>() << " (" << device.getInfo<CL_DEVICE_OPENCL_C_VERSION>()
+            << "), work-groups of " << executor->getLocalSize() << std::endl;
+
+  const double ARRAY_BYTES = (double) ARRAY_SIZE * sizeof(float);
+  ClTimer timer;
+  executor->setTimer(&timer);
+
+  bool success = true;
+  for(int v : variants) {
+    Variant variant = (Variant) v;
+    std::string label = std::string(variantNames[v]) + "/sum";
+    if(!executor->supports(variant)) {
+      std::cout << label << ": not supported by the device, skipped" << std::endl;
+      continue;
+    }
+
+    // the kernels on the input already on the device; global_reduce overwrites it, like
+    // global_reduce_kernel does, which is fine for timing
+    executor->load(h_in.data(), ARRAY_SIZE);
+    Benchmark("opencl/reduce", label + "/kernels").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+      timer.Start();
+      executor->run(variant, ARRAY_SIZE);
+      timer.Stop();
+      return timer.Elapsed(ClTimer::KERNEL);
+    });
+
+    // the kernels again, this time writing the input before every trial
+    Benchmark("opencl/reduce", label + "/end_to_end").bytes(ARRAY_BYTES).elements(ARRAY_SIZE).run([&] {
+      timer.Start();
+      executor->load(h_in.data(), ARRAY_SIZE);
+      executor->run(variant, ARRAY_SIZE);
+      timer.Stop();
+      return timer.Elapsed(ClTimer::WRITE) + timer.Elapsed(ClTimer::KERNEL);
+    });
+
+    // float partials in a different order than the host's double sum, so the check is relative
+    double result = executor->result();
+    bool equal = std::fabs(result - expected) <= 1e-4 * std::max(1.0, std::fabs(expected));
+    success = success && equal;
+    std::cout << label << ": result " << result << " (host: " << expected << ")" << (equal ? "" : " MISMATCH") << std::endl;
+  }
+
+  std::cout << "status: " << (success ? "SUCCESS!" : "FAILED!") << std::endl;
+  return success ? 0 : 1;
+}
+
+
+// initialize the device and compile the kernels, with the 2.0 ones where the device has them
+void initializeDevice() {
+
+  // select the best ranked device, or the one named by $OPENCL_DEVICE
+  device = Devices::select();
+
+  // take the embedded kernel source, or read the OpenCL kernel file as a string
+  std::string src = Devices::kernelSource("reduce.cl", reduceSource, reduceSourceLength);
+
+  // compile kernel program which will run on the device, or load it from a previous run
+  context = cl::Context(device);
+  program = ProgramCache::build(context, device, src, buildOptions(device));
+
+  // create the queue, kernels and buffers once for every later reduction
+  executor.reset(new ReduceExecutor(context, device, program));
+}
+
+
+// without -cl-std the compiler takes OpenCL C 1.2, which has neither the work-group nor the
+// subgroup functions; reduce.cl only defines those kernels when the version has them. 3.0 is
+// asked for as 3.0, since its optional features are what decide there
+std::string buildOptions(const cl::Device& device) {
+  std::istringstream version(device.getInfo<CL_DEVICE_OPENCL_C_VERSION>());   // "OpenCL C 2.0 ..."
+  std::string opencl, c;
+  int major = 1, minor = 2;
+  char dot;
+  version >> opencl >> c >> major >> dot >> minor;
+
+  if(major >= 3) {
+    return "-cl-std=CL3.0";
+  }
+  if(major == 2) {
+    return "-cl-std=CL2.0";
+  }
+  return "";
+}
+
+
+// a kernel the program lacks is left out; the local size is the largest power of two up to
+// 256 that every kernel it has can run
+ReduceExecutor::ReduceExecutor(const cl::Context& context, const cl::Device& device, const cl::Program& program)
+  : context(context), device(device), queue(context, device, CL_QUEUE_PROFILING_ENABLE), local(256), capacity(0),
+    timer(nullptr) {
+  for(int v = 0; v < VARIANTS; v++) {
+    cl_int err;
+    kernels[v] = cl::Kernel(program, variantKernels[v], &err);
+    available[v] = err == CL_SUCCESS;
+    if(available[v]) {
+      local = std::min(local, kernels[v].getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    }
+  }
+
+  size_t p = 1;
+  while(p * 2 <= local) {
+    p *= 2;
+  }
+  local = p;
+
+  sum = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, sizeof(float));
+}
+
+
+// grow the buffers for N elements: the input, and the partials of the first two passes,
+// which later passes reuse; smaller requests keep them
+void ReduceExecutor::reserve(const int N) {
+  if(N <= capacity) {
+    return;
+  }
+
+  // global_reduce writes its input, so it is read-write
+  input = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_WRITE_ONLY, N * sizeof(float));
+  partials[0] = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, groups(N) * sizeof(float));
+  partials[1] = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, std::max(groups(groups(N)), 1) * sizeof(float));
+
+  capacity = N;
+}
+
+
+void ReduceExecutor::load(const float* h_in, const int N) {
+  reserve(N);
+  queue.enqueueWriteBuffer(input, CL_FALSE, 0, N * sizeof(float), h_in, nullptr, track(ClTimer::WRITE));
+}
+
+
+// one pass over n elements of "in", one partial sum per work-group into "out"
+void ReduceExecutor::pass(Variant v, const cl::Buffer& in, const cl::Buffer& out, const int n) {
+  cl::Kernel& kernel = kernels[v];
+  kernel.setArg(0, in);
+  kernel.setArg(1, out);
+  kernel.setArg(2, n);
+  if(v == LOCAL_REDUCE || v == SUBGROUP_REDUCE) {
+    kernel.setArg(3, cl::Local(local * sizeof(float)));
+  }
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(groups(n) * local), cl::NDRange(local),
+                             nullptr, track(ClTimer::KERNEL));
+}
+
+
+// reduce the input until one work-group is left, which writes the sum; the three kernels
+// over a million elements with work-groups of 256 are the three launches of reduce_passes
+void ReduceExecutor::run(Variant v, const int N) {
+  reserve(N);
+
+  const cl::Buffer* in = &input;
+  int n = N, next = 0;
+  while(groups(n) > 1) {
+    pass(v, *in, partials[next], n);
+    in = &partials[next];
+    n = groups(n);
+    next = 1 - next;
+  }
+  pass(v, *in, sum, n);
+}
+
+
+float ReduceExecutor::result() {
+  float h_out;
+  queue.enqueueReadBuffer(sum, CL_TRUE, 0, sizeof(float), &h_out, nullptr, track(ClTimer::READ));
+  return h_out;
+}
+
+
+// sequentially sums the N elements; double keeps the reference close to the exact sum
+double seqReduce(const float* in, const int N) {
+  double sum = 0;
+  for(int i = 0; i < N; i++) {
+    sum += in[i];
+  }
+  return sum;
+}
@@ -1,6 +1,15 @@
-__kernel void add(__global int* a, __global int* b, __global int* c) {
+// each work-item adds one int4 per step of a grid-stride loop, so any global size covers any n;
+// the last n % 4 elements do not fill a vector and are added one by one
+__kernel void add(__global const int* a, __global const int* b, __global int* c, const int n) {
   
-  int idx = get_global_id(0);
-  c[idx] = a[idx] + b[idx];
+  int vecs = n / 4;
+  for(int i = get_global_id(0); i < vecs; i += get_global_size(0)) {
+    vstore4(vload4(i, a) + vload4(i, b), i, c);
+  }
+
+  int tail = vecs * 4 + get_global_id(0);
+  if(tail < n) {
+    c[tail] = a[tail] + b[tail];
+  }
   
 }
@@ -1,26 +1,169 @@
 #include <CL/cl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <vector>
-#include <time.h>
+#include "../../common/benchmark.h"
+#include "../../common/tuning.h"
+#include "../cltimer.h"
+#include "../cltrace.h"
+#include "../device.h"
+#include "../program_cache.h"
+#include "cpu_sum.h"
+
+#ifdef EMBED_KERNELS
+#include "add_cl.h"     // generated at build time with: xxd -i add.cl > add_cl.h
+static const unsigned char* addSource = add_cl;
+static const size_t addSourceLength = add_cl_len;
+#else
+static const unsigned char* addSource = nullptr;
+static const size_t addSourceLength = 0;
+#endif
+
+
+// keeps the queue, the kernel and the device buffers alive between calls, so that a
+// call only enqueues the input writes, the kernel and the output read
+class SumExecutor {
+public:
+  SumExecutor(const cl::Context& context, const cl::Device& device, const cl::Program& program);
+
+  void reserve(const int N);                                // Grow the device buffers so they hold at least N elements.
+  void run(int* a, int* b, int* c, const int N);            // Performs c = a + b using the cached resources.
+  void enqueue(int* a, int* b, int* c, const int N);        // Same as run, but returns before c is written.
+  void finish();                                            // Wait until everything enqueued has completed.
+  void runMapped(int* a, int* b, int* c, const int N);      // Performs c = a + b through mapped host memory.
+  void runStreamed(int* a, int* b, int* c, const size_t N, size_t chunk = 0);  // Performs c = a + b in overlapped chunks.
+  size_t defaultChunkSize() const;                          // Chunk size derived from the device memory size.
+  bool hasUnifiedMemory() const { return unifiedMemory; }   // Whether the device shares physical memory with the host.
+  void setTimer(ClTimer* t) { timer = t; }                  // Track every later command in t, nullptr stops tracking.
+  void tune(const int N);                                   // Pick the launch shape for N elements, loaded or swept.
+  const LaunchConfig& getLaunch() const { return launch; }  // Work-group size (0: the driver's) and int4s per work-item.
+
+private:
+  void setArgs(const cl::Buffer& a, const cl::Buffer& b, const cl::Buffer& c, const int N);  // Point the kernel at N elements.
+  cl::NDRange globalRange(const int N) const;               // Work-items needed for N elements.
+  cl::NDRange localRange() const;                           // Work-group size of the launch shape.
+  void reserveStaging(const int N);                         // Grow the pinned staging buffers to at least N elements.
+  void reserveSlots(const size_t chunk);                    // Grow the streaming buffers to at least chunk elements.
+  cl::Event* track(ClTimer::Stage stage) {                  // Event for the timer, or the tracer, if any.
+    return timer ? timer->Track(stage) : TRACE_CL_EVENT(ClTimer::StageName(stage), ClTimer::StagePhase(stage));
+  }
+
+  // one set of device buffers of the streaming pipeline; "done" completes when its chunk was read back
+  struct StreamSlot {
+    cl::Buffer a, b, c;
+    cl::Event done;
+  };
+  static const int STREAM_SLOTS = 3;                        // Chunk k+1 is written while k runs and k-1 is read.
+
+  cl::Context context;
+  cl::Device device;
+  cl::CommandQueue queue;
+  cl::Kernel kernel;
+  LaunchConfig launch;
+  cl::Buffer aBuf, bBuf, cBuf;
+  int capacity;                                             // Number of elements the buffers can currently hold.
+
+  bool unifiedMemory;                                       // Integrated GPUs and CPU devices skip the copies entirely.
+  cl::Buffer aStage, bStage, cStage;                        // Pinned host buffers used by discrete devices.
+  int *aPinned, *bPinned, *cPinned;                         // Host pointers of the permanently mapped staging buffers.
+  int stagingCapacity;
+
+  cl::CommandQueue writeQueue, readQueue;                   // Transfer queues, the kernels run on "queue".
+  StreamSlot slots[STREAM_SLOTS];
+  size_t slotCapacity;
+
+  ClTimer* timer;                                           // Tracks the commands when set.
+};
+
+
+// splits c = a + b across several devices, each with its own context and SumExecutor. every
+// device gets a share of the range proportional to the throughput it reached in calibrate()
+class MultiSumExecutor {
+public:
+  MultiSumExecutor(const std::vector<cl::Device>& devices, const std::string& src);
+
+  void calibrate(int* a, int* b, int* c, const int N);      // Time every device alone on N elements and set the shares.
+  void run(int* a, int* b, int* c, const int N);            // Performs c = a + b on all devices at once.
+  size_t size() const { return executors.size(); }          // Number of devices used.
+  const std::vector<double>& getShares() const { return shares; }  // Fraction of the range each device gets.
+  const std::vector<cl::Device>& getDevices() const { return devices; }
+
+private:
+  std::vector<cl::Device> devices;
+  std::vector<std::unique_ptr<SumExecutor>> executors;
+  std::vector<double> shares;
+};
 
 
-cl::Device getDefaultDevice();                            // Return the first device found in this OpenCL platform.
 void initializeDevice();                                  // Inicialize device and compile kernel code.
 void seqSumArrays(int* a, int* b, int* c, const int N);   // Sequentially performs the N-dimensional operation c = a + b.
+void cpuSumArrays(int* a, int* b, int* c, const int N);   // Same as seqSumArrays, but on every core with SIMD.
 void parSumArrays(int* a, int* b, int* c, const int N);   // Parallelly performs the N-dimensional operation c = a + b.
+void mapSumArrays(int* a, int* b, int* c, const int N);   // Same as parSumArrays, but through mapped host memory.
+void streamSumArrays(int* a, int* b, int* c, const size_t N, const size_t chunk);  // Same as parSumArrays, but streamed in chunks.
+void multiSumArrays(int* a, int* b, int* c, const int N); // Same as parSumArrays, but split across all devices.
 bool checkEquality(int* c1, int* c2, const int N);        // Check if the N-dimensional arrays c1 and c2 are equal.
 
 cl::Program program;    // The program that will run on the device.    
 cl::Context context;    // The context which holds the device.    
 cl::Device device;      // The device where the kernel will run.
+std::unique_ptr<SumExecutor> executor;    // The reusable executor created by initializeDevice().
+std::unique_ptr<MultiSumExecutor> multiExecutor;    // Spans every device, only created when there are several.
+std::unique_ptr<CpuSumExecutor> cpuExecutor;        // The thread pool of cpuSumArrays.
+
+// median wall time of the repetitions of f on N elements, in ms, registered in the benchmark
+// harness as "name"; clock() would add up the CPU time of every thread
+template <typename F>
+double medianTime(const char* name, const int N, F f, const int executions) {
+  return Benchmark("vector_add", name).bytes(3.0 * N * sizeof(int)).elements(N).repetitions(executions)
+    .run([&] { return wallTime(f); }).median;
+}
+
+// like medianTime, with the commands of the last repetition tracked by "timer"
+template <typename F>
+double profiledTime(const char* name, const int N, ClTimer& timer, F f, const int executions) {
+  executor->setTimer(&timer);
+  double median = medianTime(name, N, [&] { timer.Start(); f(); timer.Stop(); }, executions);
+  executor->setTimer(nullptr);
+  return median;
+}
 
-int main() {
+// device time of the writes, the kernels and the reads the timer tracked
+std::string stageTimes(ClTimer& timer) {
+  std::ostringstream out;
+  out << " (last run: write " << timer.Elapsed(ClTimer::WRITE) << " ms, kernel " << timer.Elapsed(ClTimer::KERNEL)
+      << " ms, read " << timer.Elapsed(ClTimer::READ) << " ms)";
+  return out.str();
+}
+
+// the tuned launch shape, as the results show it
+std::string launchName(const LaunchConfig& launch) {
+  std::ostringstream out;
+  if(launch.blockSize > 0) {
+    out << "work-groups of " << launch.blockSize;
+  } else {
+    out << "driver work-groups";
+  }
+  out << ", " << launch.itemsPerThread << " int4 per work-item";
+  return out.str();
+}
+
+int main(int argc, char** argv) {
     
   // create auxiliary variables
-  clock_t start, end;
   const int EXECUTIONS = 10;
 
+  // the chunk size of the streamed run may be given in elements, 0 derives it from the device memory
+  size_t chunk = 0;
+  if (argc == 2) {
+    chunk = atol(argv[1]);
+  }
+
   // prepare input arrays
   int ARRAYS_DIM = 1 << 20;
   std::vector<int> a(ARRAYS_DIM, 3);
@@ -28,88 +171,397 @@ int main() {
 
   // prepare sequential and parallel outputs
   std::vector<int> cs(ARRAYS_DIM);
+  std::vector<int> ct(ARRAYS_DIM);
   std::vector<int> cp(ARRAYS_DIM);
+  std::vector<int> cm(ARRAYS_DIM);
+  std::vector<int> cc(ARRAYS_DIM);
+  std::vector<int> cd(ARRAYS_DIM);
 
   // sequentially sum arrays
-  start = clock();
-  for(int i = 0; i < EXECUTIONS; i++) {
-    seqSumArrays(a.data(), b.data(), cs.data(), ARRAYS_DIM);
-  }
-  end = clock();
-  double seqTime = ((double) 10e3 * (end - start)) / CLOCKS_PER_SEC / EXECUTIONS;
+  double seqTime = medianTime("sequential", ARRAYS_DIM, [&] { seqSumArrays(a.data(), b.data(), cs.data(), ARRAYS_DIM); }, EXECUTIONS);
+
+  // sum arrays on every core with SIMD; the warmup runs wake the pool up
+  cpuExecutor.reset(new CpuSumExecutor());
+  double cpuTime = medianTime("cpu", ARRAYS_DIM, [&] { cpuSumArrays(a.data(), b.data(), ct.data(), ARRAYS_DIM); }, EXECUTIONS);
+
+  // the GPU has to beat the best the CPU can do on its own
+  double bestCpuTime = std::min(seqTime, cpuTime);
 
-  // initialize OpenCL device
+  // initialize OpenCL device, and its launch shape for this size
   initializeDevice();
+  executor->tune(ARRAYS_DIM);
 
   // parallelly sum arrays
-  start = clock();
-  for(int i = 0; i < EXECUTIONS; i++) {
-    parSumArrays(a.data(), b.data(), cp.data(), ARRAYS_DIM);
+  ClTimer parTimer, mapTimer, streamTimer;
+  double parTime = profiledTime("copy", ARRAYS_DIM, parTimer, [&] { parSumArrays(a.data(), b.data(), cp.data(), ARRAYS_DIM); }, EXECUTIONS);
+
+  // parallelly sum arrays through mapped host memory
+  double mapTime = profiledTime("mapped", ARRAYS_DIM, mapTimer, [&] { mapSumArrays(a.data(), b.data(), cm.data(), ARRAYS_DIM); }, EXECUTIONS);
+
+  // parallelly sum arrays in overlapped chunks
+  double streamTime = profiledTime("streamed", ARRAYS_DIM, streamTimer,
+                                   [&] { streamSumArrays(a.data(), b.data(), cc.data(), ARRAYS_DIM, chunk); }, EXECUTIONS);
+
+  // parallelly sum arrays on all devices at once, split by a calibration run
+  double multiTime = 0;
+  if(multiExecutor) {
+    multiExecutor->calibrate(a.data(), b.data(), cd.data(), ARRAYS_DIM);
+    multiTime = medianTime("multi_device", ARRAYS_DIM, [&] { multiSumArrays(a.data(), b.data(), cd.data(), ARRAYS_DIM); }, EXECUTIONS);
   }
-  end = clock();
-  double parTime = ((double) 10e3 * (end - start)) / CLOCKS_PER_SEC / EXECUTIONS;
 
   // check if outputs are equal
-  bool equal = checkEquality(cs.data(), cp.data(), ARRAYS_DIM);
+  bool equal;
+  {
+    TRACE_RANGE("check", TRACE_VERIFICATION);
+    equal = checkEquality(cs.data(), ct.data(), ARRAYS_DIM) &&
+            checkEquality(cs.data(), cp.data(), ARRAYS_DIM) && checkEquality(cs.data(), cm.data(), ARRAYS_DIM) &&
+            checkEquality(cs.data(), cc.data(), ARRAYS_DIM) && (!multiExecutor || checkEquality(cs.data(), cd.data(), ARRAYS_DIM));
+  }
 
   // print results
   std::cout << "status: " << (equal ? "SUCCESS!" : "FAILED!") << std::endl;
   std::cout << "results: \n\ta[0] = " << a[0] << "\n\tb[0] = " << b[0] << "\n\tc[0] = a[0] + b[0] = " << cp[0] << std::endl;
-  std::cout << "mean execution time: \n\tsequential: " << seqTime << " ms;\n\tparallel: " << parTime << " ms." << std::endl;
-  std::cout << "performance gain: " << (100 * (seqTime - parTime) / parTime) << "\%\n";
-  
+  std::cout << "median execution time: \n\tsequential: " << seqTime << " ms;"
+            << "\n\tcpu (" << cpuExecutor->size() << " threads, " << cpuExecutor->isaName() << "): " << cpuTime << " ms;"
+            << "\n\tparallel (copy, " << launchName(executor->getLaunch()) << "): " << parTime << " ms" << stageTimes(parTimer) << ";"
+            << "\n\tparallel (" << (executor->hasUnifiedMemory() ? "zero-copy" : "pinned staging") << "): " << mapTime << " ms"
+            << stageTimes(mapTimer) << ";"
+            << "\n\tparallel (streamed, " << (chunk ? chunk : executor->defaultChunkSize()) << " elements per chunk): " << streamTime << " ms"
+            << stageTimes(streamTimer) << "." << std::endl;
+  std::cout << "speedup over the best cpu run (" << (cpuTime < seqTime ? "cpu" : "sequential") << "): "
+            << "\n\tcopy: " << (bestCpuTime / parTime) << "x"
+            << "\n\tmapped: " << (bestCpuTime / mapTime) << "x"
+            << "\n\tstreamed: " << (bestCpuTime / streamTime) << "x\n";
+
+  if(multiExecutor) {
+    std::cout << "multi-device execution time: " << multiTime << " ms, speedup: " << (bestCpuTime / multiTime) << "x\n";
+    for(size_t d = 0; d < multiExecutor->size(); d++) {
+      std::cout << "\t" << multiExecutor->getDevices()[d].getInfo<CL_DEVICE_NAME>() << ": "
+                << (100 * multiExecutor->getShares()[d]) << "\% of the range\n";
+    }
+  }
+
+  TRACE_DUMP();
   return 0;
 }
 
 
-// return the first device found in this OpenCL platform
-cl::Device getDefaultDevice() {
-    
-  // Search for all the OpenCL platforms available and check if there are any
-  std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
+// inicialize device and compile kernel code
+void initializeDevice() {
+
+  // select the best ranked device, or the one named by $OPENCL_DEVICE
+  device = Devices::select();
+  
+  // take the embedded kernel source, or read the OpenCL kernel file as a string
+  std::string src = Devices::kernelSource("add.cl", addSource, addSourceLength);
+
+  // compile kernel program which will run on the device, or load it from a previous run
+  context = cl::Context(device);
+  program = ProgramCache::build(context, device, src);
+
+  // create the queue, kernel and buffers once for every later parSumArrays call
+  executor.reset(new SumExecutor(context, device, program));
 
-  if (platforms.empty()) {
-    std::cerr << "no platforms found!" << std::endl;
-    exit(1);
+  // a second executor spans every device, when there is more than one
+  auto all = Devices::ranked();
+  if(all.size() > 1) {
+    multiExecutor.reset(new MultiSumExecutor(all, src));
   }
+}
 
-  // search for all the devices on the first platform and check if there are any available
-  auto platform = platforms.front();
-  std::vector<cl::Device> devices;
-  platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
 
-  if (devices.empty()) {
-    std::cerr << "no devices found!" << std::endl;
-    exit(1);
+MultiSumExecutor::MultiSumExecutor(const std::vector<cl::Device>& devices, const std::string& src)
+  : devices(devices), shares(devices.size(), 1.0 / devices.size()) {
+
+  // devices of different platforms cannot share a context, so each one gets its own
+  for(auto& device : devices) {
+    cl::Context context(device);
+    cl::Program program = ProgramCache::build(context, device, src);
+    executors.emplace_back(new SumExecutor(context, device, program));
+  }
+}
+
+
+// tune every device for N elements, then run them on it alone, after a warm-up run, and
+// give each device a share of the range proportional to the throughput it reached
+void MultiSumExecutor::calibrate(int* a, int* b, int* c, const int N) {
+  const int RUNS = 3;
+  std::vector<double> throughput(executors.size());
+  double total = 0;
+
+  for(size_t d = 0; d < executors.size(); d++) {
+    executors[d]->tune(N);
+    executors[d]->run(a, b, c, N);
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < RUNS; i++) {
+      executors[d]->run(a, b, c, N);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    throughput[d] = RUNS * N / elapsed.count();
+    total += throughput[d];
   }
 
-  // return the first device found
-  return devices.front();
+  for(size_t d = 0; d < executors.size(); d++) {
+    shares[d] = throughput[d] / total;
+  }
 }
 
 
-// inicialize device and compile kernel code
-void initializeDevice() {
+// enqueue every device's slice first and only then wait, so the devices work at the same time;
+// slices start at multiples of 4 so each device still adds whole int4s
+void MultiSumExecutor::run(int* a, int* b, int* c, const int N) {
+  int offset = 0;
+  for(size_t d = 0; d < executors.size(); d++) {
+    int count = N - offset;
+    if(d + 1 < executors.size()) {
+      count = std::min(count, (int) (N * shares[d]) / 4 * 4);
+    }
+    if(count > 0) {
+      executors[d]->enqueue(a + offset, b + offset, c + offset, count);
+    }
+    offset += count;
+  }
 
-  // select the first available device
-  device = getDefaultDevice();
-  
-  // read OpenCL kernel file as a string
-  std::ifstream kernel_file("add.cl");
-  std::string src(std::istreambuf_iterator<char>(kernel_file), (std::istreambuf_iterator<char>()));
+  for(auto& executor : executors) {
+    executor->finish();
+  }
+}
 
-  // compile kernel program which will run on the device
-  cl::Program::Sources sources(1, std::make_pair(src.c_str(), src.length() + 1));
-  context = cl::Context(device);
-  program = cl::Program(context, sources);
-  
-  auto err = program.build();
-  if(err != CL_BUILD_SUCCESS) {
-    std::cerr << "build status:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) << std::endl;
-    std::cerr << "build log   :\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;              
-    exit(1);
+
+SumExecutor::SumExecutor(const cl::Context& context, const cl::Device& device, const cl::Program& program)
+  : context(context), device(device), queue(context, device, CL_QUEUE_PROFILING_ENABLE), kernel(program, "add"),
+    launch({ 0, 1 }), capacity(0), aPinned(nullptr), bPinned(nullptr), cPinned(nullptr), stagingCapacity(0),
+    writeQueue(context, device, CL_QUEUE_PROFILING_ENABLE), readQueue(context, device, CL_QUEUE_PROFILING_ENABLE),
+    slotCapacity(0), timer(nullptr) {
+  unifiedMemory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() || device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+}
+
+
+// grow the device buffers so they hold at least N elements; smaller requests reuse them
+void SumExecutor::reserve(const int N) {
+  if(N <= capacity) {
+    return;
   }
+  TRACE_RANGE_BYTES("reserve", TRACE_ALLOCATION, 3.0 * N * sizeof(int));
+
+  aBuf = cl::Buffer(context, CL_MEM_READ_ONLY  |  CL_MEM_HOST_WRITE_ONLY, N * sizeof(int));
+  bBuf = cl::Buffer(context, CL_MEM_READ_ONLY  |  CL_MEM_HOST_WRITE_ONLY, N * sizeof(int));
+  cBuf = cl::Buffer(context, CL_MEM_WRITE_ONLY |  CL_MEM_HOST_READ_ONLY,  N * sizeof(int));
+
+  capacity = N;
+}
+
+
+// point the kernel at the first N elements of the given buffers
+void SumExecutor::setArgs(const cl::Buffer& a, const cl::Buffer& b, const cl::Buffer& c, const int N) {
+  kernel.setArg(0, a);
+  kernel.setArg(1, b);
+  kernel.setArg(2, c);
+  kernel.setArg(3, N);
+}
+
+
+// one work-item per launch.itemsPerThread int4s, but at least enough work-items for the scalar
+// tail of up to 3 elements; a whole number of work-groups when the launch sets their size
+cl::NDRange SumExecutor::globalRange(const int N) const {
+  int items = std::max(N / 4 / launch.itemsPerThread, 4);
+  if(launch.blockSize > 0) {
+    items = (items + launch.blockSize - 1) / launch.blockSize * launch.blockSize;
+  }
+  return cl::NDRange(items);
+}
+
+
+cl::NDRange SumExecutor::localRange() const {
+  return launch.blockSize > 0 ? cl::NDRange(launch.blockSize) : cl::NullRange;
+}
+
+
+// the launch shape for N elements: from the tuning file of the device, or else the fastest
+// kernel time over work-group sizes in multiples of the kernel's preferred one, and 1 to 16
+// int4s per work-item. drivers have no occupancy calculator to start from, the preferred
+// multiple is the hint they give
+void SumExecutor::tune(const int N) {
+  reserve(N);
+  setArgs(aBuf, bBuf, cBuf, N);
+
+  int multiple = (int) kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+  int maxSize  = (int) kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+  TuningFile tuning(device.getInfo<CL_DEVICE_NAME>() + "_" + device.getInfo<CL_DRIVER_VERSION>());
+  LaunchConfig fallback = { 0, 1 };
+  launch = autotune(tuning, tuningKey("vector_add/add", N), blockSizeCandidates(multiple, multiple, maxSize),
+                    { 1, 2, 4, 8, 16 }, fallback, [&](const LaunchConfig& candidate) {
+    launch = candidate;
+    cl::Event event;
+    if(queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange(N), localRange(), nullptr, &event) != CL_SUCCESS) {
+      return -1.0;
+    }
+    event.wait();
+    return (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1e6;
+  });
+}
+
+
+// grow the pinned staging buffers; they stay mapped so the host can fill them directly
+void SumExecutor::reserveStaging(const int N) {
+  if(N <= stagingCapacity) {
+    return;
+  }
+  TRACE_RANGE_BYTES("reserveStaging", TRACE_ALLOCATION, 3.0 * N * sizeof(int));
+
+  if(stagingCapacity > 0) {
+    queue.enqueueUnmapMemObject(aStage, aPinned);
+    queue.enqueueUnmapMemObject(bStage, bPinned);
+    queue.enqueueUnmapMemObject(cStage, cPinned);
+  }
+
+  aStage = cl::Buffer(context, CL_MEM_READ_ONLY  |  CL_MEM_ALLOC_HOST_PTR, N * sizeof(int));
+  bStage = cl::Buffer(context, CL_MEM_READ_ONLY  |  CL_MEM_ALLOC_HOST_PTR, N * sizeof(int));
+  cStage = cl::Buffer(context, CL_MEM_WRITE_ONLY |  CL_MEM_ALLOC_HOST_PTR, N * sizeof(int));
+
+  aPinned = (int*) queue.enqueueMapBuffer(aStage, CL_TRUE, CL_MAP_WRITE, 0, N * sizeof(int));
+  bPinned = (int*) queue.enqueueMapBuffer(bStage, CL_TRUE, CL_MAP_WRITE, 0, N * sizeof(int));
+  cPinned = (int*) queue.enqueueMapBuffer(cStage, CL_TRUE, CL_MAP_READ,  0, N * sizeof(int));
+  stagingCapacity = N;
+}
+
+
+// performs c = a + b; the in-order queue runs the writes, the kernel and the read back to back
+void SumExecutor::run(int* a, int* b, int* c, const int N) {
+  enqueue(a, b, c, N);
+  finish();
+}
+
+
+// enqueue c = a + b without waiting; a, b and c must stay valid until finish() returns
+void SumExecutor::enqueue(int* a, int* b, int* c, const int N) {
+  reserve(N);
+
+  setArgs(aBuf, bBuf, cBuf, N);
+
+  TRACE_BYTES(TRACE_TRANSFER, 3.0 * N * sizeof(int));
+  queue.enqueueWriteBuffer(aBuf, CL_FALSE, 0, N * sizeof(int), a, nullptr, track(ClTimer::WRITE));
+  queue.enqueueWriteBuffer(bBuf, CL_FALSE, 0, N * sizeof(int), b, nullptr, track(ClTimer::WRITE));
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange(N), localRange(), nullptr, track(ClTimer::KERNEL));
+  queue.enqueueReadBuffer(cBuf, CL_FALSE, 0, N * sizeof(int), c, nullptr, track(ClTimer::READ));
+}
+
+
+void SumExecutor::finish() {
+  queue.finish();
+}
+
+
+// performs c = a + b through mapped host memory: on unified memory devices the kernel works
+// on the host arrays in place, discrete devices transfer through pinned staging buffers
+void SumExecutor::runMapped(int* a, int* b, int* c, const int N) {
+  if(unifiedMemory) {
+    cl::Buffer aHost(context, CL_MEM_READ_ONLY  |  CL_MEM_USE_HOST_PTR, N * sizeof(int), a);
+    cl::Buffer bHost(context, CL_MEM_READ_ONLY  |  CL_MEM_USE_HOST_PTR, N * sizeof(int), b);
+    cl::Buffer cHost(context, CL_MEM_WRITE_ONLY |  CL_MEM_USE_HOST_PTR, N * sizeof(int), c);
+
+    setArgs(aHost, bHost, cHost, N);
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange(N), localRange(), nullptr, track(ClTimer::KERNEL));
+
+    // mapping c synchronizes the host array with what the kernel wrote, without a copy
+    void* result = queue.enqueueMapBuffer(cHost, CL_TRUE, CL_MAP_READ, 0, N * sizeof(int), nullptr, track(ClTimer::READ));
+    queue.enqueueUnmapMemObject(cHost, result);
+    queue.finish();
+    return;
+  }
+
+  reserve(N);
+  reserveStaging(N);
+
+  setArgs(aBuf, bBuf, cBuf, N);
+
+  // the transfers from and to page-locked memory run at full DMA speed
+  TRACE_BYTES(TRACE_TRANSFER, 3.0 * N * sizeof(int));
+  std::memcpy(aPinned, a, N * sizeof(int));
+  std::memcpy(bPinned, b, N * sizeof(int));
+  queue.enqueueWriteBuffer(aBuf, CL_FALSE, 0, N * sizeof(int), aPinned, nullptr, track(ClTimer::WRITE));
+  queue.enqueueWriteBuffer(bBuf, CL_FALSE, 0, N * sizeof(int), bPinned, nullptr, track(ClTimer::WRITE));
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange(N), localRange(), nullptr, track(ClTimer::KERNEL));
+  queue.enqueueReadBuffer(cBuf, CL_TRUE, 0, N * sizeof(int), cPinned, nullptr, track(ClTimer::READ));
+  std::memcpy(c, cPinned, N * sizeof(int));
+}
+
+
+// the streaming buffers take a quarter of the global memory, but no single buffer may exceed
+// the maximum allocation size
+size_t SumExecutor::defaultChunkSize() const {
+  auto globalMemory = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+  auto maxAlloc     = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+
+  size_t chunk = globalMemory / 4 / (3 * STREAM_SLOTS * sizeof(int));
+  return std::min<size_t>(chunk, maxAlloc / sizeof(int));
+}
+
+
+// grow the buffers of every streaming slot so they hold at least chunk elements
+void SumExecutor::reserveSlots(const size_t chunk) {
+  if(chunk <= slotCapacity) {
+    return;
+  }
+  TRACE_RANGE_BYTES("reserveSlots", TRACE_ALLOCATION, 3.0 * STREAM_SLOTS * chunk * sizeof(int));
+
+  for(auto& slot : slots) {
+    slot.a = cl::Buffer(context, CL_MEM_READ_ONLY  |  CL_MEM_HOST_WRITE_ONLY, chunk * sizeof(int));
+    slot.b = cl::Buffer(context, CL_MEM_READ_ONLY  |  CL_MEM_HOST_WRITE_ONLY, chunk * sizeof(int));
+    slot.c = cl::Buffer(context, CL_MEM_WRITE_ONLY |  CL_MEM_HOST_READ_ONLY,  chunk * sizeof(int));
+    slot.done = cl::Event();
+  }
+  slotCapacity = chunk;
+}
+
+
+// performs c = a + b over arrays that need not fit on the device: the input is split into
+// chunks that cycle through STREAM_SLOTS buffer sets, and three in-order queues chained by
+// events overlap the write of chunk k+1, the kernel on chunk k and the read of chunk k-1
+void SumExecutor::runStreamed(int* a, int* b, int* c, const size_t N, size_t chunk) {
+  if(chunk == 0) {
+    chunk = defaultChunkSize();
+  }
+  chunk = std::min(chunk, N);
+  reserveSlots(chunk);
+
+  for(size_t offset = 0, k = 0; offset < N; offset += chunk, k++) {
+    auto& slot = slots[k % STREAM_SLOTS];
+    size_t count = std::min(chunk, N - offset);
+
+    // the slot can only be overwritten once the chunk it held before was read back
+    std::vector<cl::Event> slotFree;
+    if(slot.done()) {
+      slotFree.push_back(slot.done);
+    }
+
+    TRACE_BYTES(TRACE_TRANSFER, 3.0 * count * sizeof(int));
+    std::vector<cl::Event> written(2), computed(1);
+    writeQueue.enqueueWriteBuffer(slot.a, CL_FALSE, 0, count * sizeof(int), a + offset, &slotFree, &written[0]);
+    writeQueue.enqueueWriteBuffer(slot.b, CL_FALSE, 0, count * sizeof(int), b + offset, &slotFree, &written[1]);
+
+    setArgs(slot.a, slot.b, slot.c, (int) count);
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange((int) count), localRange(), &written, &computed[0]);
+
+    readQueue.enqueueReadBuffer(slot.c, CL_FALSE, 0, count * sizeof(int), c + offset, &computed, &slot.done);
+
+    if(timer) {
+      timer->Record(ClTimer::WRITE, written[0]);
+      timer->Record(ClTimer::WRITE, written[1]);
+      timer->Record(ClTimer::KERNEL, computed[0]);
+      timer->Record(ClTimer::READ, slot.done);
+    }
+
+    // make sure every queue starts working on what was just enqueued
+    writeQueue.flush();
+    queue.flush();
+    readQueue.flush();
+  }
+
+  readQueue.finish();
 }
 
 
@@ -121,24 +573,33 @@ void seqSumArrays(int* a, int* b, int* c, const int N) {
 }
 
 
+// performs the N-dimensional operation c = a + b on the thread pool
+void cpuSumArrays(int* a, int* b, int* c, const int N) {
+  cpuExecutor->run(a, b, c, N);
+}
+
+
 // parallelly performs the N-dimensional operation c = a + b
 void parSumArrays(int* a, int* b, int* c, const int N) {
-    
-  // create buffers and allocate memory on the device
-  cl::Buffer aBuf(context, CL_MEM_READ_ONLY  |  CL_MEM_HOST_NO_ACCESS  |  CL_MEM_COPY_HOST_PTR, N * sizeof(int), a);
-  cl::Buffer bBuf(context, CL_MEM_READ_ONLY  |  CL_MEM_HOST_NO_ACCESS  |  CL_MEM_COPY_HOST_PTR, N * sizeof(int), b);
-  cl::Buffer cBuf(context, CL_MEM_WRITE_ONLY |  CL_MEM_HOST_READ_ONLY, N * sizeof(int));
-
-  // set kernel arguments
-  cl::Kernel kernel(program, "sumArrays");
-  kernel.setArg(0, aBuf);
-  kernel.setArg(1, bBuf);
-  kernel.setArg(2, cBuf);
-
-  // execute the kernel function and collect its result
-  cl::CommandQueue queue(context, device);
-  queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(N));
-  queue.enqueueReadBuffer(cBuf, CL_TRUE, 0, N * sizeof(int), c);
+  executor->run(a, b, c, N);
+}
+
+
+// parallelly performs the N-dimensional operation c = a + b through mapped host memory
+void mapSumArrays(int* a, int* b, int* c, const int N) {
+  executor->runMapped(a, b, c, N);
+}
+
+
+// parallelly performs the N-dimensional operation c = a + b in overlapped chunks of the given size
+void streamSumArrays(int* a, int* b, int* c, const size_t N, const size_t chunk) {
+  executor->runStreamed(a, b, c, N, chunk);
+}
+
+
+// parallelly performs the N-dimensional operation c = a + b, split across all devices
+void multiSumArrays(int* a, int* b, int* c, const int N) {
+  multiExecutor->run(a, b, c, N);
 }
 
 
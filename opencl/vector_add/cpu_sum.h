@@ -0,0 +1,185 @@
+#ifndef __CPU_SUM_H__
+#define __CPU_SUM_H__
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_SUM_X86
+#include <immintrin.h>
+#endif
+
+
+// the CPU side of c = a + b, as fast as the host can do it: the range is split across a pool
+// of worker threads, and each slice is added with the widest SIMD instructions the CPU has,
+// picked once at run time so the same binary runs on any x86 (or any other) host
+class CpuSumExecutor {
+public:
+  typedef void (*SumKernel)(const int* a, const int* b, int* c, int N);
+
+  CpuSumExecutor(unsigned threads = std::thread::hardware_concurrency());
+  ~CpuSumExecutor();
+
+  void run(const int* a, const int* b, int* c, const int N);   // Performs c = a + b on all threads.
+  unsigned size() const { return workers.size() + 1; }        // Number of threads, the caller's included.
+  const char* isaName() const { return isa; }                  // The instruction set picked for the slices.
+
+private:
+  struct Job {
+    const int* a;
+    const int* b;
+    int* c;
+    int N;
+  };
+
+  void work(unsigned index);
+  void runSlice(unsigned index, const Job& job) const;
+
+  static void sumScalar(const int* a, const int* b, int* c, int N);
+#ifdef CPU_SUM_X86
+  static void sumAvx2(const int* a, const int* b, int* c, int N);
+  static void sumAvx512(const int* a, const int* b, int* c, int N);
+#endif
+
+  SumKernel kernel;
+  const char* isa;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;       // a new job is there, or the pool is stopping
+  std::condition_variable done;       // every worker finished its slice
+  Job job;
+  unsigned generation;                // counts the jobs, so a worker runs each one once
+  unsigned pending;                   // workers still busy with the current job
+  bool stopping;
+};
+
+
+inline CpuSumExecutor::CpuSumExecutor(unsigned threads)
+  : kernel(sumScalar), isa("scalar"), job(), generation(0), pending(0), stopping(false) {
+
+#ifdef CPU_SUM_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) {
+    kernel = sumAvx512;
+    isa = "AVX-512";
+  } else if(__builtin_cpu_supports("avx2")) {
+    kernel = sumAvx2;
+    isa = "AVX2";
+  }
+#endif
+
+  // the calling thread takes a slice as well
+  for(unsigned i = 1; i < std::max(threads, 1u); i++) {
+    workers.emplace_back(&CpuSumExecutor::work, this, i);
+  }
+}
+
+
+inline CpuSumExecutor::~CpuSumExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for(auto& worker : workers) {
+    worker.join();
+  }
+}
+
+
+// hand the job to the workers, add the first slice on this thread, and wait for the rest
+inline void CpuSumExecutor::run(const int* a, const int* b, int* c, const int N) {
+  Job current = { a, b, c, N };
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = current;
+    pending = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  runSlice(0, current);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return pending == 0; });
+}
+
+
+inline void CpuSumExecutor::work(unsigned index) {
+  unsigned seen = 0;
+  for(;;) {
+    Job current;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if(stopping) {
+        return;
+      }
+      seen = generation;
+      current = job;
+    }
+
+    runSlice(index, current);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(--pending == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+
+// slices are multiples of 16 ints, a whole AVX-512 vector, so only the last one has a tail
+inline void CpuSumExecutor::runSlice(unsigned index, const Job& job) const {
+  int slice = (job.N / (int) size() + 15) / 16 * 16;
+  int begin = std::min(job.N, (int) index * slice);
+  int end = index + 1 == size() ? job.N : std::min(job.N, begin + slice);
+  if(end > begin) {
+    kernel(job.a + begin, job.b + begin, job.c + begin, end - begin);
+  }
+}
+
+
+inline void CpuSumExecutor::sumScalar(const int* a, const int* b, int* c, int N) {
+  for(int i = 0; i < N; i++) {
+    c[i] = a[i] + b[i];
+  }
+}
+
+
+#ifdef CPU_SUM_X86
+// the target attributes let these compile without -mavx2 or -mavx512f; they only run when
+// the constructor found the CPU supports them
+__attribute__((target("avx2")))
+inline void CpuSumExecutor::sumAvx2(const int* a, const int* b, int* c, int N) {
+  int i = 0;
+  for(; i + 8 <= N; i += 8) {
+    __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+    _mm256_storeu_si256((__m256i*) (c + i), _mm256_add_epi32(va, vb));
+  }
+  for(; i < N; i++) {
+    c[i] = a[i] + b[i];
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void CpuSumExecutor::sumAvx512(const int* a, const int* b, int* c, int N) {
+  int i = 0;
+  for(; i + 16 <= N; i += 16) {
+    __m512i va = _mm512_loadu_si512((const void*) (a + i));
+    __m512i vb = _mm512_loadu_si512((const void*) (b + i));
+    _mm512_storeu_si512((void*) (c + i), _mm512_add_epi32(va, vb));
+  }
+  for(; i < N; i++) {
+    c[i] = a[i] + b[i];
+  }
+}
+#endif
+
+#endif  /* __CPU_SUM_H__ */